@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory_resource>
+
+#include "smart_pointers.h"
+
+// std::pmr::polymorphic_allocator works as the Alloc of allocateShared,
+// makeSharedBatch and SharedPtr(U*, Deleter, Alloc) like any other
+// allocator, and stores just its resource pointer in each block.
+//
+// ArenaAllocator is the same single pointer for monotonic resources such
+// as std::pmr::monotonic_buffer_resource. Deallocation does nothing and
+// does not call into the resource, so freeing a block costs no virtual
+// call; the memory comes back all at once when the arena is released.
+// Objects are still destroyed when their last reference goes, and no
+// pointer may outlive the release of its arena.
+template <typename T>
+class ArenaAllocator {
+  public:
+    using value_type = T;
+
+    explicit ArenaAllocator(std::pmr::memory_resource* resource)
+        : resource(resource) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        : resource(other.resource) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(resource->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return resource == other.resource;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return resource != other.resource;
+    }
+
+  private:
+    template <typename U>
+    friend class ArenaAllocator;
+
+    std::pmr::memory_resource* resource;
+};
+
+template <typename U, typename Policy = AtomicPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<U>, SharedPtr<U, Policy>> makeSharedIn(
+    std::pmr::memory_resource* resource, Args&&... args) {
+    return allocateShared<U, Policy>(
+        std::pmr::polymorphic_allocator<U>(resource),
+        std::forward<Args>(args)...);
+}
+
+template <typename U, typename Policy = AtomicPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<U>, SharedPtr<U, Policy>> makeSharedInArena(
+    std::pmr::memory_resource* arena, Args&&... args) {
+    return allocateShared<U, Policy>(ArenaAllocator<U>(arena),
+                                     std::forward<Args>(args)...);
+}
+
+static_assert(sizeof(ControlBlockMakeShared<void*, ArenaAllocator<void*>,
+                                           AtomicPolicy>) ==
+                  sizeof(BaseControlBlock<AtomicPolicy>) + 2 * sizeof(void*),
+              "arena blocks must hold only the resource pointer");
+static_assert(
+    sizeof(ControlBlockMakeShared<void*, std::pmr::polymorphic_allocator<void*>,
+                                  AtomicPolicy>) ==
+        sizeof(BaseControlBlock<AtomicPolicy>) + 2 * sizeof(void*),
+    "pmr blocks must hold only the resource pointer");
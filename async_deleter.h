@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "smart_pointers.h"
+
+// A deleter that hands the actual deletion to an executor, for objects
+// whose destruction blocks, such as file handles or GPU buffers. The
+// thread that drops the last reference only schedules the task; the
+// control block is freed as usual and only the object waits for it.
+//
+// Executor is anything with execute(task) for a nullary task, e.g. the
+// DeletionThread below or an adapter for a coroutine scheduler. It is held
+// by reference and must outlive every pointer using it. If scheduling
+// throws, the object is deleted inline instead.
+template <typename Executor, typename Deleter>
+struct AsyncDeleter {
+    Executor* executor;
+    Deleter deleter;
+
+    template <typename T>
+    void operator()(T* ptr) {
+        try {
+            executor->execute(
+                [deleter = deleter, ptr]() mutable { deleter(ptr); });
+        } catch (...) {
+            deleter(ptr);
+        }
+    }
+};
+
+// For SharedPtr<T>(new T(...), deleteOn<T>(executor)).
+template <typename T, typename Executor,
+          typename Deleter = std::default_delete<T>>
+AsyncDeleter<Executor, Deleter> deleteOn(Executor& executor,
+                                         Deleter deleter = Deleter()) {
+    return AsyncDeleter<Executor, Deleter>{&executor, std::move(deleter)};
+}
+
+// Runs tasks in order on one background thread. Tasks still pending when
+// it is destroyed are run before the thread exits.
+class DeletionThread {
+  public:
+    DeletionThread() : worker([this] { run(); }) {}
+
+    DeletionThread(const DeletionThread&) = delete;
+    DeletionThread& operator=(const DeletionThread&) = delete;
+
+    ~DeletionThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    template <typename Task>
+    void execute(Task&& task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back(std::forward<Task>(task));
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every task scheduled so far has run.
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return tasks.empty() && !busy; });
+    }
+
+  private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            busy = true;
+            lock.unlock();
+            task();
+            lock.lock();
+            busy = false;
+            if (tasks.empty()) {
+                idle.notify_all();
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<std::function<void()>> tasks;
+    bool busy = false;
+    bool stopping = false;
+    std::thread worker;
+};
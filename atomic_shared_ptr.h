@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "smart_pointers.h"
+
+// Equivalent of std::atomic<std::shared_ptr<T>>. The low bit of the stored
+// control-block address is a spinlock that is only held while the pointer
+// pair is copied and the count bumped, so readers never wait on a writer
+// releasing the previous value: references are dropped after unlocking.
+template <typename T>
+class AtomicSharedPtr {
+  private:
+    using Shared = SharedPtr<T, AtomicPolicy>;
+    using ControlBlock = BaseControlBlock<AtomicPolicy>;
+
+    static constexpr uintptr_t kLockBit = 1;
+
+    mutable std::atomic<uintptr_t> cb{0};
+    T* ptr = nullptr;
+
+    uintptr_t lock() const {
+        uintptr_t current = cb.load(std::memory_order_relaxed);
+        while (true) {
+            if ((current & kLockBit) != 0) {
+                std::this_thread::yield();
+                current = cb.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (cb.compare_exchange_weak(current, current | kLockBit,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed)) {
+                return current;
+            }
+        }
+    }
+
+    void unlock(uintptr_t value) const {
+        cb.store(value, std::memory_order_release);
+    }
+
+    static uintptr_t pack(ControlBlock* block) {
+        return reinterpret_cast<uintptr_t>(block);
+    }
+
+    static ControlBlock* unpack(uintptr_t value) {
+        return reinterpret_cast<ControlBlock*>(value);
+    }
+
+    // Swaps the stored pair with `other`; the caller holds the lock and
+    // passes the value it observed when taking it.
+    void swapLocked(Shared& other, uintptr_t& locked) {
+        std::swap(ptr, other.ptr);
+        ControlBlock* previous = unpack(locked);
+        locked = pack(other.cb);
+        other.cb = previous;
+    }
+
+  public:
+    AtomicSharedPtr() = default;
+
+    AtomicSharedPtr(Shared desired) {
+        uintptr_t locked = 0;
+        swapLocked(desired, locked);
+        cb.store(locked, std::memory_order_relaxed);
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ~AtomicSharedPtr() {
+        Shared owned;
+        owned.ptr = ptr;
+        owned.cb = unpack(cb.load(std::memory_order_relaxed));
+    }
+
+    bool is_lock_free() const {
+        return false;
+    }
+
+    Shared load(std::memory_order = std::memory_order_seq_cst) const {
+        Shared result;
+        uintptr_t locked = lock();
+        result.ptr = ptr;
+        result.cb = unpack(locked);
+        if (result.cb != nullptr) {
+            acquireShared(result.cb);
+        }
+        unlock(locked);
+        return result;
+    }
+
+    void store(Shared desired,
+               std::memory_order = std::memory_order_seq_cst) {
+        exchange(std::move(desired));
+    }
+
+    Shared exchange(Shared desired,
+                    std::memory_order = std::memory_order_seq_cst) {
+        uintptr_t locked = lock();
+        swapLocked(desired, locked);
+        unlock(locked);
+        return desired;
+    }
+
+    bool compare_exchange_strong(
+        Shared& expected, Shared desired,
+        std::memory_order = std::memory_order_seq_cst) {
+        uintptr_t locked = lock();
+        if (ptr == expected.ptr && unpack(locked) == expected.cb) {
+            swapLocked(desired, locked);
+            unlock(locked);
+            return true;
+        }
+        Shared current;
+        current.ptr = ptr;
+        current.cb = unpack(locked);
+        if (current.cb != nullptr) {
+            acquireShared(current.cb);
+        }
+        unlock(locked);
+        expected.swap(current);
+        return false;
+    }
+
+    bool compare_exchange_strong(Shared& expected, Shared desired,
+                                 std::memory_order success,
+                                 std::memory_order) {
+        return compare_exchange_strong(expected, std::move(desired),
+                                       success);
+    }
+
+    bool compare_exchange_weak(
+        Shared& expected, Shared desired,
+        std::memory_order order = std::memory_order_seq_cst) {
+        return compare_exchange_strong(expected, std::move(desired), order);
+    }
+
+    bool compare_exchange_weak(Shared& expected, Shared desired,
+                               std::memory_order success,
+                               std::memory_order) {
+        return compare_exchange_strong(expected, std::move(desired),
+                                       success);
+    }
+
+    AtomicSharedPtr& operator=(Shared desired) {
+        store(std::move(desired));
+        return *this;
+    }
+
+    operator Shared() const {
+        return load();
+    }
+};
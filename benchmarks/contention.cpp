@@ -0,0 +1,257 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "atomic_shared_ptr.h"
+#include "families.h"
+#include "weak_value_cache.h"
+
+namespace {
+
+constexpr int kMaxThreads = 64;
+
+// One object per family, shared by all benchmark threads and created by
+// whichever thread gets there first.
+template <typename F>
+typename F::template Shared<Payload>& sharedObject() {
+    static typename F::template Shared<Payload> object =
+        F::template make<Payload>(1);
+    return object;
+}
+
+template <typename F>
+typename F::template Weak<Payload>& weakObject() {
+    static typename F::template Weak<Payload> weak(sharedObject<F>());
+    return weak;
+}
+
+template <typename F>
+void BM_CopyContended(benchmark::State& state) {
+    const auto& shared = sharedObject<F>();
+    for (auto _ : state) {
+        auto copy = shared;
+        benchmark::DoNotOptimize(copy.get());
+    }
+}
+
+template <typename F>
+void BM_WeakLockContended(benchmark::State& state) {
+    const auto& weak = weakObject<F>();
+    for (auto _ : state) {
+        auto locked = weak.lock();
+        benchmark::DoNotOptimize(locked.get());
+    }
+}
+
+// Thread 0 keeps writing to the object while the others copy and drop
+// references to it. With makeShared the counts share a cache line with the
+// written field; makeSharedPadded moves the object to its own line.
+struct Padded : Atomic {
+    template <typename T, typename... Args>
+    static Shared<T> make(Args&&... args) {
+        return makeSharedPadded<T>(std::forward<Args>(args)...);
+    }
+};
+
+// Copies of an immortal object skip the counts altogether.
+struct Immortal : Atomic {
+    template <typename T, typename... Args>
+    static Shared<T> make(Args&&... args) {
+        return makeImmortal<T>(std::forward<Args>(args)...);
+    }
+};
+
+template <typename F>
+void BM_FalseSharing(benchmark::State& state) {
+    const auto& shared = sharedObject<F>();
+    if (state.thread_index() == 0) {
+        Payload* object = shared.get();
+        for (auto _ : state) {
+            object->value += 1;
+            benchmark::ClobberMemory();
+        }
+        return;
+    }
+    for (auto _ : state) {
+        auto copy = shared;
+        benchmark::DoNotOptimize(copy.get());
+    }
+}
+
+// Ways to publish one SharedPtr to many readers.
+struct AtomicHolder {
+    AtomicSharedPtr<Payload> value{makeShared<Payload>(1)};
+
+    SharedPtr<Payload> load() const {
+        return value.load();
+    }
+
+    void store(SharedPtr<Payload> desired) {
+        value.store(std::move(desired));
+    }
+};
+
+struct MutexHolder {
+    mutable std::mutex mutex;
+    SharedPtr<Payload> value = makeShared<Payload>(1);
+
+    SharedPtr<Payload> load() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return value;
+    }
+
+    void store(SharedPtr<Payload> desired) {
+        std::lock_guard<std::mutex> lock(mutex);
+        value.swap(desired);
+    }
+};
+
+struct StdAtomicHolder {
+    std::shared_ptr<Payload> value = std::make_shared<Payload>(1);
+
+    std::shared_ptr<Payload> load() const {
+        return std::atomic_load(&value);
+    }
+
+    void store(std::shared_ptr<Payload> desired) {
+        std::atomic_store(&value, std::move(desired));
+    }
+};
+
+template <typename Holder>
+Holder& holder() {
+    static auto* instance = new Holder();
+    return *instance;
+}
+
+template <typename Holder>
+void BM_PublishedLoad(benchmark::State& state) {
+    const Holder& published = holder<Holder>();
+    for (auto _ : state) {
+        auto loaded = published.load();
+        benchmark::DoNotOptimize(loaded.get());
+    }
+}
+
+// Thread 0 replaces the value on every iteration while the others read.
+template <typename Holder>
+void BM_PublishedStoreLoad(benchmark::State& state) {
+    Holder& published = holder<Holder>();
+    if (state.thread_index() == 0) {
+        auto first = published.load();
+        auto second = first;
+        second.reset(new Payload(2));
+        for (auto _ : state) {
+            published.store(second);
+            published.store(first);
+        }
+        return;
+    }
+    for (auto _ : state) {
+        auto loaded = published.load();
+        benchmark::DoNotOptimize(loaded.get());
+    }
+}
+
+// Lookups of live entries, the common case for a cache of shared objects.
+constexpr int kCacheKeys = 1024;
+
+struct ShardedCache {
+    WeakValueCache<int, Payload> cache;
+
+    SharedPtr<Payload> find(int key) const {
+        return cache.find(key);
+    }
+
+    void insert(int key, const SharedPtr<Payload>& value) {
+        cache.insert(key, value);
+    }
+};
+
+struct MutexCache {
+    mutable std::mutex mutex;
+    std::unordered_map<int, WeakPtr<Payload>> entries;
+
+    SharedPtr<Payload> find(int key) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = entries.find(key);
+        return found == entries.end() ? SharedPtr<Payload>()
+                                      : found->second.lock();
+    }
+
+    void insert(int key, const SharedPtr<Payload>& value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.insert_or_assign(key, WeakPtr<Payload>(value));
+    }
+};
+
+template <typename Cache>
+const Cache& filledCache() {
+    static auto* values = new std::vector<SharedPtr<Payload>>();
+    static auto* cache = [] {
+        auto* filled = new Cache();
+        for (int key = 0; key < kCacheKeys; ++key) {
+            values->push_back(makeShared<Payload>(key));
+            filled->insert(key, values->back());
+        }
+        return filled;
+    }();
+    return *cache;
+}
+
+template <typename Cache>
+void BM_CacheHit(benchmark::State& state) {
+    const Cache& cache = filledCache<Cache>();
+    int key = state.thread_index() * 7;
+    for (auto _ : state) {
+        auto found = cache.find(key);
+        benchmark::DoNotOptimize(found.get());
+        key = (key + 1) % kCacheKeys;
+    }
+}
+
+}  // namespace
+
+#define CONTENDED_BENCHMARK(name, family) \
+    BENCHMARK_TEMPLATE(name, family)->ThreadRange(1, kMaxThreads)->UseRealTime()
+
+CONTENDED_BENCHMARK(BM_CopyContended, Std);
+CONTENDED_BENCHMARK(BM_CopyContended, Atomic);
+CONTENDED_BENCHMARK(BM_CopyContended, Biased);
+CONTENDED_BENCHMARK(BM_CopyContended, Compact);
+CONTENDED_BENCHMARK(BM_CopyContended, Deferred);
+CONTENDED_BENCHMARK(BM_CopyContended, Epoch);
+CONTENDED_BENCHMARK(BM_CopyContended, Immortal);
+
+CONTENDED_BENCHMARK(BM_WeakLockContended, Std);
+CONTENDED_BENCHMARK(BM_WeakLockContended, Atomic);
+CONTENDED_BENCHMARK(BM_WeakLockContended, Biased);
+CONTENDED_BENCHMARK(BM_WeakLockContended, Compact);
+CONTENDED_BENCHMARK(BM_WeakLockContended, Deferred);
+CONTENDED_BENCHMARK(BM_WeakLockContended, Epoch);
+CONTENDED_BENCHMARK(BM_WeakLockContended, Immortal);
+
+BENCHMARK_TEMPLATE(BM_FalseSharing, Std)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FalseSharing, Atomic)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FalseSharing, Padded)->ThreadRange(2, 32)->UseRealTime();
+
+CONTENDED_BENCHMARK(BM_PublishedLoad, StdAtomicHolder);
+CONTENDED_BENCHMARK(BM_PublishedLoad, MutexHolder);
+CONTENDED_BENCHMARK(BM_PublishedLoad, AtomicHolder);
+
+BENCHMARK_TEMPLATE(BM_PublishedStoreLoad, StdAtomicHolder)
+    ->ThreadRange(2, kMaxThreads)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PublishedStoreLoad, MutexHolder)
+    ->ThreadRange(2, kMaxThreads)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PublishedStoreLoad, AtomicHolder)
+    ->ThreadRange(2, kMaxThreads)
+    ->UseRealTime();
+
+CONTENDED_BENCHMARK(BM_CacheHit, MutexCache);
+CONTENDED_BENCHMARK(BM_CacheHit, ShardedCache);
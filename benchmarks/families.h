@@ -0,0 +1,119 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "biased_policy.h"
+#include "compact_policy.h"
+#include "deferred_policy.h"
+#include "epoch_policy.h"
+#include "instrumented_policy.h"
+#include "local_shared_ptr.h"
+#include "smart_pointers.h"
+#include "tracked_policy.h"
+
+// Put SharedPtr under each policy and std::shared_ptr behind one interface,
+// so that every benchmark is instantiated side by side for all of them.
+template <typename Policy>
+struct Ours {
+    template <typename T>
+    using Shared = SharedPtr<T, Policy>;
+
+    template <typename T>
+    using Weak = WeakPtr<T, Policy>;
+
+    template <typename T, typename... Args>
+    static Shared<T> make(Args&&... args) {
+        return makeShared<T, Policy>(std::forward<Args>(args)...);
+    }
+
+    template <typename T, typename Alloc, typename... Args>
+    static Shared<T> allocate(const Alloc& alloc, Args&&... args) {
+        return allocateShared<T, Policy>(alloc, std::forward<Args>(args)...);
+    }
+
+    template <typename T, typename... Args>
+    static std::vector<Shared<T>> makeBatch(size_t size,
+                                            const Args&... args) {
+        return makeSharedBatch<T, Policy>(size, args...);
+    }
+
+    template <typename T>
+    static Shared<T> adopt(T* object) {
+        return Shared<T>(object);
+    }
+
+    // Destroys whatever a deferring policy has retired so far.
+    static void collect() {
+        if constexpr (std::is_same_v<Policy, DeferredPolicy>) {
+            drainRetired();
+        } else if constexpr (std::is_same_v<Policy, EpochPolicy>) {
+            reclaimEpochRetired();
+        }
+    }
+};
+
+struct Std {
+    template <typename T>
+    using Shared = std::shared_ptr<T>;
+
+    template <typename T>
+    using Weak = std::weak_ptr<T>;
+
+    template <typename T, typename... Args>
+    static Shared<T> make(Args&&... args) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename T, typename Alloc, typename... Args>
+    static Shared<T> allocate(const Alloc& alloc, Args&&... args) {
+        return std::allocate_shared<T>(alloc, std::forward<Args>(args)...);
+    }
+
+    template <typename T, typename... Args>
+    static std::vector<Shared<T>> makeBatch(size_t size,
+                                            const Args&... args) {
+        std::vector<Shared<T>> batch;
+        batch.reserve(size);
+        for (size_t i = 0; i < size; ++i) {
+            batch.push_back(std::make_shared<T>(args...));
+        }
+        return batch;
+    }
+
+    template <typename T>
+    static Shared<T> adopt(T* object) {
+        return Shared<T>(object);
+    }
+
+    static void collect() {}
+};
+
+using Atomic = Ours<AtomicPolicy>;
+using Local = Ours<LocalPolicy>;
+using Biased = Ours<BiasedPolicy>;
+using Compact = Ours<CompactAtomicPolicy>;
+using Deferred = Ours<DeferredPolicy>;
+using Epoch = Ours<EpochPolicy>;
+using Instrumented = Ours<InstrumentedPolicy<>>;
+using Tracked = Ours<TrackedPolicy<>>;
+using Upgradable = Ours<UpgradablePolicy>;
+
+// Benchmarks that drop last references call this once per iteration, so
+// deferring policies pay for reclamation but memory stays bounded.
+template <typename F>
+void collectEvery(size_t& counter, size_t interval = 1024) {
+    if (++counter == interval) {
+        counter = 0;
+        F::collect();
+    }
+}
+
+// A small object with a payload that survives optimisation.
+struct Payload {
+    long value;
+
+    explicit Payload(long value = 0) : value(value) {}
+};
@@ -0,0 +1,327 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "arena_allocator.h"
+#include "async_deleter.h"
+#include "families.h"
+#include "pool_allocator.h"
+
+namespace {
+
+constexpr size_t kBatch = 1024;
+
+template <typename F>
+void BM_ConstructAdopt(benchmark::State& state) {
+    size_t counter = 0;
+    for (auto _ : state) {
+        auto shared = F::adopt(new Payload(1));
+        benchmark::DoNotOptimize(shared.get());
+        collectEvery<F>(counter);
+    }
+}
+
+template <typename F>
+void BM_ConstructMake(benchmark::State& state) {
+    size_t counter = 0;
+    for (auto _ : state) {
+        auto shared = F::template make<Payload>(1);
+        benchmark::DoNotOptimize(shared.get());
+        collectEvery<F>(counter);
+    }
+}
+
+template <typename F>
+void BM_ConstructAllocate(benchmark::State& state) {
+    std::allocator<Payload> alloc;
+    size_t counter = 0;
+    for (auto _ : state) {
+        auto shared = F::template allocate<Payload>(alloc, 1);
+        benchmark::DoNotOptimize(shared.get());
+        collectEvery<F>(counter);
+    }
+}
+
+template <typename F>
+void BM_ConstructAllocatePool(benchmark::State& state) {
+    PoolAllocator<Payload> alloc;
+    size_t counter = 0;
+    for (auto _ : state) {
+        auto shared = F::template allocate<Payload>(alloc, 1);
+        benchmark::DoNotOptimize(shared.get());
+        collectEvery<F>(counter);
+    }
+}
+
+// Per-request objects from a monotonic arena that is released wholesale
+// after every batch, through the pmr allocator or ArenaAllocator.
+template <typename F, typename Alloc>
+void BM_ConstructArena(benchmark::State& state) {
+    std::pmr::monotonic_buffer_resource arena;
+    Alloc alloc(&arena);
+    size_t counter = 0;
+    for (auto _ : state) {
+        auto shared = F::template allocate<Payload>(alloc, 1);
+        benchmark::DoNotOptimize(shared.get());
+        if (++counter == kBatch) {
+            counter = 0;
+            shared.reset();
+            arena.release();
+        }
+    }
+}
+
+// A whole batch of objects, made one by one for std::shared_ptr.
+template <typename F>
+void BM_ConstructBatch(benchmark::State& state) {
+    for (auto _ : state) {
+        auto batch = F::template makeBatch<Payload>(kBatch, 1);
+        benchmark::DoNotOptimize(batch.data());
+        batch.clear();
+        F::collect();
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+// Walks objects made together with makeBatch, the case a slab lays out
+// contiguously.
+template <typename F>
+void BM_IterateBatch(benchmark::State& state) {
+    auto batch = F::template makeBatch<Payload>(kBatch, 1);
+    for (auto _ : state) {
+        long sum = 0;
+        for (const auto& shared : batch) {
+            sum += shared->value;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+template <typename F>
+void BM_Copy(benchmark::State& state) {
+    auto shared = F::template make<Payload>(1);
+    for (auto _ : state) {
+        auto copy = shared;
+        benchmark::DoNotOptimize(copy.get());
+    }
+}
+
+template <typename F>
+void BM_CopyAssign(benchmark::State& state) {
+    auto first = F::template make<Payload>(1);
+    auto second = F::template make<Payload>(2);
+    auto target = first;
+    for (auto _ : state) {
+        target = second;
+        target = first;
+        benchmark::DoNotOptimize(target.get());
+    }
+}
+
+template <typename F>
+void BM_Move(benchmark::State& state) {
+    auto first = F::template make<Payload>(1);
+    decltype(first) second;
+    for (auto _ : state) {
+        second = std::move(first);
+        first = std::move(second);
+        benchmark::DoNotOptimize(first.get());
+    }
+}
+
+template <typename F>
+void BM_SelfAssign(benchmark::State& state) {
+    auto shared = F::template make<Payload>(1);
+    auto alias = shared;
+    for (auto _ : state) {
+        alias = shared;
+        benchmark::DoNotOptimize(alias.get());
+    }
+}
+
+// Sorting moves every element several times through swaps and temporaries.
+template <typename F>
+void BM_SortVector(benchmark::State& state) {
+    std::vector<typename F::template Shared<Payload>> items;
+    std::mt19937 random(42);
+    for (size_t i = 0; i < kBatch; ++i) {
+        items.push_back(F::template make<Payload>(random()));
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::shuffle(items.begin(), items.end(), random);
+        state.ResumeTiming();
+        std::sort(items.begin(), items.end(),
+                  [](const auto& lhs, const auto& rhs) {
+                      return lhs->value < rhs->value;
+                  });
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+// Reallocation moves the elements only if the move constructor is noexcept.
+template <typename F>
+void BM_VectorGrow(benchmark::State& state) {
+    auto shared = F::template make<Payload>(1);
+    for (auto _ : state) {
+        std::vector<typename F::template Shared<Payload>> items;
+        for (size_t i = 0; i < kBatch; ++i) {
+            items.push_back(shared);
+        }
+        benchmark::DoNotOptimize(items.data());
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+template <typename F>
+void BM_Deref(benchmark::State& state) {
+    auto shared = F::template make<Payload>(1);
+    long sum = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(shared);
+        sum += shared->value;
+    }
+    benchmark::DoNotOptimize(sum);
+}
+
+template <typename F>
+void BM_WeakLock(benchmark::State& state) {
+    auto shared = F::template make<Payload>(1);
+    typename F::template Weak<Payload> weak(shared);
+    for (auto _ : state) {
+        auto locked = weak.lock();
+        benchmark::DoNotOptimize(locked.get());
+    }
+}
+
+// Times only the release of the last reference, in batches so that the
+// allocation stays outside the measurement.
+template <typename F>
+void BM_DestroyLast(benchmark::State& state) {
+    std::vector<typename F::template Shared<Payload>> batch;
+    batch.reserve(kBatch);
+    for (auto _ : state) {
+        state.PauseTiming();
+        F::collect();
+        for (size_t i = 0; i < kBatch; ++i) {
+            batch.push_back(F::template make<Payload>(1));
+        }
+        state.ResumeTiming();
+        batch.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+// Same with a weak reference outstanding, so the object is destroyed while
+// the block stays allocated.
+template <typename F>
+void BM_DestroyLastWithWeak(benchmark::State& state) {
+    std::vector<typename F::template Shared<Payload>> batch;
+    std::vector<typename F::template Weak<Payload>> weak;
+    batch.reserve(kBatch);
+    weak.reserve(kBatch);
+    for (auto _ : state) {
+        state.PauseTiming();
+        weak.clear();
+        F::collect();
+        for (size_t i = 0; i < kBatch; ++i) {
+            batch.push_back(F::template make<Payload>(1));
+            weak.emplace_back(batch.back());
+        }
+        state.ResumeTiming();
+        batch.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+// Raw access without count updates against a full lock() round trip.
+void BM_WeakProtect(benchmark::State& state) {
+    auto shared = Epoch::make<Payload>(1);
+    Epoch::Weak<Payload> weak(shared);
+    long sum = 0;
+    for (auto _ : state) {
+        auto guard = weak.protect();
+        sum += guard->value;
+    }
+    benchmark::DoNotOptimize(sum);
+}
+
+// Stands in for a close() or buffer release that blocks for a microsecond.
+struct SlowDelete {
+    void operator()(Payload* object) const {
+        auto until =
+            std::chrono::steady_clock::now() + std::chrono::microseconds(1);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+        delete object;
+    }
+};
+
+// What the thread dropping the last reference pays, inline or with the
+// deletion handed to a DeletionThread, which catches up between batches.
+template <bool Async>
+void BM_DestroyLastSlowDeleter(benchmark::State& state) {
+    DeletionThread deletions;
+    size_t counter = 0;
+    for (auto _ : state) {
+        if constexpr (Async) {
+            SharedPtr<Payload> shared(new Payload(1),
+                                      deleteOn<Payload>(deletions,
+                                                        SlowDelete()));
+            benchmark::DoNotOptimize(shared.get());
+        } else {
+            SharedPtr<Payload> shared(new Payload(1), SlowDelete());
+            benchmark::DoNotOptimize(shared.get());
+        }
+        if (++counter == kBatch) {
+            counter = 0;
+            state.PauseTiming();
+            deletions.drain();
+            state.ResumeTiming();
+        }
+    }
+}
+
+}  // namespace
+
+#define LIFECYCLE_BENCHMARK(name)           \
+    BENCHMARK_TEMPLATE(name, Std);          \
+    BENCHMARK_TEMPLATE(name, Atomic);       \
+    BENCHMARK_TEMPLATE(name, Local);        \
+    BENCHMARK_TEMPLATE(name, Biased);       \
+    BENCHMARK_TEMPLATE(name, Compact);      \
+    BENCHMARK_TEMPLATE(name, Deferred);     \
+    BENCHMARK_TEMPLATE(name, Epoch);        \
+    BENCHMARK_TEMPLATE(name, Instrumented); \
+    BENCHMARK_TEMPLATE(name, Tracked);      \
+    BENCHMARK_TEMPLATE(name, Upgradable)
+
+LIFECYCLE_BENCHMARK(BM_ConstructAdopt);
+LIFECYCLE_BENCHMARK(BM_ConstructMake);
+LIFECYCLE_BENCHMARK(BM_ConstructAllocate);
+LIFECYCLE_BENCHMARK(BM_ConstructAllocatePool);
+LIFECYCLE_BENCHMARK(BM_ConstructBatch);
+LIFECYCLE_BENCHMARK(BM_IterateBatch);
+LIFECYCLE_BENCHMARK(BM_Copy);
+LIFECYCLE_BENCHMARK(BM_CopyAssign);
+LIFECYCLE_BENCHMARK(BM_Move);
+LIFECYCLE_BENCHMARK(BM_SelfAssign);
+LIFECYCLE_BENCHMARK(BM_SortVector);
+LIFECYCLE_BENCHMARK(BM_VectorGrow);
+LIFECYCLE_BENCHMARK(BM_Deref);
+LIFECYCLE_BENCHMARK(BM_WeakLock);
+LIFECYCLE_BENCHMARK(BM_DestroyLast);
+LIFECYCLE_BENCHMARK(BM_DestroyLastWithWeak);
+BENCHMARK(BM_WeakProtect);
+BENCHMARK_TEMPLATE(BM_ConstructArena, Std,
+                   std::pmr::polymorphic_allocator<Payload>);
+BENCHMARK_TEMPLATE(BM_ConstructArena, Atomic,
+                   std::pmr::polymorphic_allocator<Payload>);
+BENCHMARK_TEMPLATE(BM_ConstructArena, Atomic, ArenaAllocator<Payload>);
+BENCHMARK_TEMPLATE(BM_ConstructArena, Local, ArenaAllocator<Payload>);
+BENCHMARK_TEMPLATE(BM_DestroyLastSlowDeleter, false);
+BENCHMARK_TEMPLATE(BM_DestroyLastSlowDeleter, true);
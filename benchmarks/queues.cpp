@@ -0,0 +1,107 @@
+#include <benchmark/benchmark.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "families.h"
+#include "shared_ptr_queue.h"
+
+namespace {
+
+constexpr size_t kCapacity = 1024;
+
+// Every thread runs the same number of iterations, so with even thread
+// counts each producer is matched by a consumer and the queue ends empty.
+template <typename Queue>
+Queue& queue() {
+    static auto* instance = new Queue(kCapacity);
+    return *instance;
+}
+
+template <typename Queue>
+void BM_HandOff(benchmark::State& state) {
+    using Shared = typename Queue::Shared;
+    Queue& queue = ::queue<Queue>();
+    if (state.thread_index() % 2 == 0) {
+        Shared message = Queue::make();
+        for (auto _ : state) {
+            Shared copy = message;
+            while (!queue.tryPush(copy)) {
+            }
+        }
+    } else {
+        Shared received;
+        for (auto _ : state) {
+            while (!queue.tryPop(received)) {
+            }
+            benchmark::DoNotOptimize(received.get());
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <template <typename, typename> class LockFree>
+struct OursQueue : LockFree<Payload, AtomicPolicy> {
+    using Shared = SharedPtr<Payload>;
+
+    explicit OursQueue(size_t capacity)
+        : LockFree<Payload, AtomicPolicy>(capacity) {}
+
+    static Shared make() {
+        return makeShared<Payload>(1);
+    }
+};
+
+using Spsc = OursQueue<SpscSharedPtrQueue>;
+using Mpmc = OursQueue<MpmcSharedPtrQueue>;
+
+// The same hand-off through a locked deque of two-word pointers.
+template <typename F>
+struct MutexQueue {
+    using Shared = typename F::template Shared<Payload>;
+
+    std::mutex mutex;
+    std::deque<Shared> items;
+    size_t capacity;
+
+    explicit MutexQueue(size_t capacity) : capacity(capacity) {}
+
+    static Shared make() {
+        return F::template make<Payload>(1);
+    }
+
+    bool tryPush(Shared& value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.size() == capacity) {
+            return false;
+        }
+        items.push_back(std::move(value));
+        return true;
+    }
+
+    bool tryPop(Shared& value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+            return false;
+        }
+        value = std::move(items.front());
+        items.pop_front();
+        return true;
+    }
+};
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_HandOff, MutexQueue<Std>)->Threads(2)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_HandOff, MutexQueue<Atomic>)->Threads(2)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_HandOff, Spsc)->Threads(2)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_HandOff, Mpmc)->Threads(2)->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_HandOff, MutexQueue<Std>)
+    ->ThreadRange(4, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_HandOff, MutexQueue<Atomic>)
+    ->ThreadRange(4, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_HandOff, Mpmc)->ThreadRange(4, 16)->UseRealTime();
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Define as 0 to use full fences on both sides instead of membarrier.
+#ifndef SMART_POINTERS_HAS_MEMBARRIER
+#if defined(__linux__) && __has_include(<linux/membarrier.h>)
+#define SMART_POINTERS_HAS_MEMBARRIER 1
+#else
+#define SMART_POINTERS_HAS_MEMBARRIER 0
+#endif
+#endif
+
+#if SMART_POINTERS_HAS_MEMBARRIER
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "smart_pointers.h"
+
+// Biased reference counting: the thread that creates a control block owns
+// its shared count and updates a private counter without atomic RMWs; all
+// other threads use a separate atomic counter. When the owner's counter
+// reaches zero it merges the two and the block behaves like AtomicPolicy
+// from then on.
+//
+// References can migrate, so the atomic counter may go negative while the
+// owner still has a positive biased counter. The thread that takes it below
+// zero revokes the bias: it folds the owner's counter into the atomic one
+// itself and releases the object if nothing is left, whether or not the
+// owner thread ever runs again. The owner only pays a compiler barrier for
+// this; the revoking thread issues a process-wide barrier (membarrier) on
+// behalf of both. Where that is unavailable, both sides use full fences.
+struct BiasedPolicy {
+    struct Count {
+        explicit Count(size_t initial);
+
+        const void* owner;
+        std::atomic<size_t> biased;
+        std::atomic<intptr_t> shared{0};
+    };
+
+    using count_type = Count;
+    using weak_count_type = std::atomic<size_t>;
+
+    static void increment(count_type& count);
+    static size_t decrement(count_type& count);
+    static size_t load(const count_type& count);
+    static bool incrementIfNonZero(count_type& count);
+
+    static void increment(weak_count_type& count) {
+        AtomicPolicy::increment(count);
+    }
+
+    static size_t decrement(weak_count_type& count) {
+        return AtomicPolicy::decrement(count);
+    }
+
+    static size_t load(const weak_count_type& count) {
+        return AtomicPolicy::load(count);
+    }
+
+    static bool incrementIfNonZero(weak_count_type& count) {
+        return AtomicPolicy::incrementIfNonZero(count);
+    }
+
+  private:
+    // The atomic word holds the reference count above two flag bits.
+    static constexpr intptr_t kMerged = 1;
+    static constexpr intptr_t kRevoking = 2;
+    static constexpr intptr_t kOne = 4;
+
+    // Left in the biased counter by the thread that revoked it.
+    static constexpr size_t kTaken = ~size_t{0};
+
+    static intptr_t references(intptr_t word) {
+        return (word - (word & (kOne - 1))) / kOne;
+    }
+
+    static bool isBiased(intptr_t word) {
+        return (word & (kMerged | kRevoking)) == 0;
+    }
+
+    static const void* currentOwner();
+    static bool asymmetricBarriers();
+    static void lightBarrier();
+    static void heavyBarrier();
+    static intptr_t waitMerged(const count_type& count);
+    static bool missedByRevocation(count_type& count);
+    static bool revoke(count_type& count);
+};
+
+// Owners are never freed, so no thread can inherit the counters of an
+// exited one through a reused address. They are kept on a global list to
+// stay reachable. The thread-local is a plain pointer, which stays valid
+// after the thread's other thread-locals have been destroyed.
+inline const void* BiasedPolicy::currentOwner() {
+    struct Owner {
+        Owner* next;
+    };
+    thread_local const void* owner = [] {
+        static std::atomic<Owner*> all{nullptr};
+        auto* created = new Owner{all.load(std::memory_order_relaxed)};
+        while (!all.compare_exchange_weak(created->next, created,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+        }
+        return static_cast<const void*>(created);
+    }();
+    return owner;
+}
+
+inline bool BiasedPolicy::asymmetricBarriers() {
+#if SMART_POINTERS_HAS_MEMBARRIER
+    static const bool registered =
+        syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED,
+                0) == 0;
+    return registered;
+#else
+    return false;
+#endif
+}
+
+// Orders the owner's store to its counter before its next load of the
+// flags, paired with heavyBarrier() on the revoking thread.
+inline void BiasedPolicy::lightBarrier() {
+    if (asymmetricBarriers()) {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+inline void BiasedPolicy::heavyBarrier() {
+#if SMART_POINTERS_HAS_MEMBARRIER
+    if (asymmetricBarriers()) {
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+        return;
+    }
+#endif
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+inline BiasedPolicy::Count::Count(size_t initial)
+    : owner(currentOwner()), biased(initial) {}
+
+// A revocation never waits for another thread, so this is short.
+inline intptr_t BiasedPolicy::waitMerged(const count_type& count) {
+    intptr_t word = count.shared.load(std::memory_order_acquire);
+    while ((word & kMerged) == 0) {
+        std::this_thread::yield();
+        word = count.shared.load(std::memory_order_acquire);
+    }
+    return word;
+}
+
+// Called by the owner after it stored to its counter. True if a thread
+// revoked the bias and took the counter before that store, so that the
+// update still has to be applied to the atomic counter.
+inline bool BiasedPolicy::missedByRevocation(count_type& count) {
+    lightBarrier();
+    if (isBiased(count.shared.load(std::memory_order_relaxed))) {
+        return false;
+    }
+    waitMerged(count);
+    return count.biased.exchange(kTaken, std::memory_order_relaxed) !=
+           kTaken;
+}
+
+// Folds the owner's counter into the atomic one. Returns true only to the
+// thread whose merge left no references, which has to release the object.
+inline bool BiasedPolicy::revoke(count_type& count) {
+    intptr_t word = count.shared.load(std::memory_order_relaxed);
+    do {
+        if (!isBiased(word)) {
+            waitMerged(count);
+            return false;
+        }
+    } while (!count.shared.compare_exchange_weak(word, word | kRevoking,
+                                                 std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed));
+    heavyBarrier();
+    size_t biased = count.biased.exchange(kTaken, std::memory_order_relaxed);
+    intptr_t delta =
+        static_cast<intptr_t>(biased) * kOne + kMerged - kRevoking;
+    intptr_t now =
+        count.shared.fetch_add(delta, std::memory_order_acq_rel) + delta;
+    return references(now) == 0;
+}
+
+inline void BiasedPolicy::increment(count_type& count) {
+    if (count.owner == currentOwner() &&
+        isBiased(count.shared.load(std::memory_order_relaxed))) {
+        count.biased.store(count.biased.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+        if (!missedByRevocation(count)) {
+            return;
+        }
+    }
+    count.shared.fetch_add(kOne, std::memory_order_relaxed);
+}
+
+// Returns zero only to the caller that has to release the object.
+inline size_t BiasedPolicy::decrement(count_type& count) {
+    if (count.owner == currentOwner() &&
+        isBiased(count.shared.load(std::memory_order_relaxed))) {
+        size_t left = count.biased.load(std::memory_order_relaxed) - 1;
+        count.biased.store(left, std::memory_order_relaxed);
+        lightBarrier();
+        intptr_t word = count.shared.load(std::memory_order_relaxed);
+        while (isBiased(word)) {
+            if (left != 0) {
+                return left;
+            }
+            if (count.shared.compare_exchange_weak(
+                    word, word | kMerged, std::memory_order_acq_rel,
+                    std::memory_order_relaxed)) {
+                return references(word) == 0 ? 0 : 1;
+            }
+        }
+        // Revoked meanwhile: the revoking thread has this decrement unless
+        // it took the counter before the store above.
+        waitMerged(count);
+        if (count.biased.exchange(kTaken, std::memory_order_relaxed) ==
+            kTaken) {
+            return 1;
+        }
+    }
+
+    intptr_t now =
+        count.shared.fetch_sub(kOne, std::memory_order_acq_rel) - kOne;
+    if ((now & kMerged) != 0) {
+        return references(now) == 0 ? 0 : 1;
+    }
+    // The owner's counter is still positive while the atomic one is not
+    // negative; a revoking thread includes this decrement in its merge.
+    if ((now & kRevoking) != 0 || references(now) >= 0) {
+        return 1;
+    }
+    return revoke(count) ? 0 : 1;
+}
+
+// Folds in the owner's counter, which other threads may read stale, so
+// like any use count this is exact only when no thread changes it.
+inline size_t BiasedPolicy::load(const count_type& count) {
+    intptr_t word = count.shared.load(std::memory_order_acquire);
+    intptr_t total = references(word);
+    if ((word & kMerged) == 0) {
+        size_t biased = count.biased.load(std::memory_order_relaxed);
+        if (biased != kTaken) {
+            total += static_cast<intptr_t>(biased);
+        }
+    }
+    return total > 0 ? static_cast<size_t>(total) : 0;
+}
+
+inline bool BiasedPolicy::incrementIfNonZero(count_type& count) {
+    intptr_t word = count.shared.load(std::memory_order_acquire);
+    if (count.owner == currentOwner() && isBiased(word)) {
+        size_t biased = count.biased.load(std::memory_order_relaxed);
+        if (static_cast<intptr_t>(biased) + references(word) <= 0) {
+            return false;
+        }
+        count.biased.store(biased + 1, std::memory_order_relaxed);
+        if (!missedByRevocation(count)) {
+            return true;
+        }
+        word = count.shared.load(std::memory_order_acquire);
+    }
+    while (true) {
+        if ((word & kMerged) == 0 &&
+            ((word & kRevoking) != 0 || references(word) < 0)) {
+            // The thread that took the count below zero is revoking the
+            // bias and will tell whether anything is left.
+            word = waitMerged(count);
+        }
+        // An unmerged block still has a positive biased counter, so a
+        // non-negative atomic one means the object is alive.
+        if ((word & kMerged) != 0 && references(word) <= 0) {
+            return false;
+        }
+        if (count.shared.compare_exchange_weak(word, word + kOne,
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_acquire)) {
+            return true;
+        }
+    }
+}
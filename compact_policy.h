@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+#include "smart_pointers.h"
+
+enum class CountOverflow { saturate, abort };
+
+// 32-bit shared and weak counts, which sit next to each other in one
+// 64-bit word of the block header, so every control block is a pointer
+// smaller than with AtomicPolicy or LocalPolicy.
+//
+// A count that reaches kLimit either aborts the process or saturates: it
+// is pinned at kSaturated, further increments and decrements leave it
+// there, and the object is never released. The gap between the two values
+// absorbs racing updates from other threads.
+template <bool Atomic = true, CountOverflow Overflow = CountOverflow::abort>
+struct CompactPolicy {
+    using count_type =
+        std::conditional_t<Atomic, std::atomic<uint32_t>, uint32_t>;
+    using weak_count_type = count_type;
+
+    static constexpr uint32_t kLimit = uint32_t{1} << 31;
+    static constexpr uint32_t kSaturated = kLimit + (kLimit >> 1);
+
+    static void increment(count_type& count) {
+        if constexpr (Atomic) {
+            uint32_t old = count.fetch_add(1, std::memory_order_relaxed);
+            if (old >= kLimit) {
+                overflow(count);
+            }
+        } else {
+            if (count >= kLimit) {
+                overflow(count);
+                return;
+            }
+            ++count;
+        }
+    }
+
+    static size_t decrement(count_type& count) {
+        if constexpr (Atomic) {
+            uint32_t old = count.fetch_sub(1, std::memory_order_acq_rel);
+            if (old >= kLimit) {
+                count.store(kSaturated, std::memory_order_relaxed);
+                return kSaturated;
+            }
+            return old - 1;
+        } else {
+            if (count >= kLimit) {
+                return count;
+            }
+            return --count;
+        }
+    }
+
+    static size_t load(const count_type& count) {
+        if constexpr (Atomic) {
+            return count.load(std::memory_order_acquire);
+        } else {
+            return count;
+        }
+    }
+
+    static bool incrementIfNonZero(count_type& count) {
+        if constexpr (Atomic) {
+            uint32_t current = count.load(std::memory_order_relaxed);
+            while (current != 0) {
+                if (current >= kLimit) {
+                    overflow(count);
+                    return true;
+                }
+                if (count.compare_exchange_weak(current, current + 1,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+            return false;
+        } else {
+            if (count == 0) {
+                return false;
+            }
+            increment(count);
+            return true;
+        }
+    }
+
+  private:
+    static void overflow(count_type& count) {
+        if constexpr (Overflow == CountOverflow::abort) {
+            std::abort();
+        } else if constexpr (Atomic) {
+            count.store(kSaturated, std::memory_order_relaxed);
+        } else {
+            count = kSaturated;
+        }
+    }
+};
+
+using CompactAtomicPolicy = CompactPolicy<true>;
+using CompactLocalPolicy = CompactPolicy<false>;
+
+static_assert(sizeof(BaseControlBlock<CompactAtomicPolicy>) ==
+                  sizeof(uint64_t) + sizeof(void*),
+              "both counts must share one 64-bit word");
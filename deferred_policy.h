@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "smart_pointers.h"
+#include "thread_teardown.h"
+
+// Atomic counts, but dropping the last SharedPtr only queues the control
+// block instead of destroying the object inline. Each thread collects its
+// retired blocks locally and publishes them to a lock-free stack in
+// batches, or sooner when a DeferredReclaimer asks for them;
+// drainRetired() or the reclaimer destroys them later. A retired block
+// keeps its owners' weak reference, so WeakPtr::lock() fails as usual
+// while the block stays valid until it is reclaimed. Blocks that are
+// released once their thread's list is gone, such as by destructors of
+// statics, are reclaimed on the spot.
+struct DeferredPolicy : AtomicPolicy {
+    using ControlBlock = BaseControlBlock<DeferredPolicy>;
+
+    static constexpr size_t kBatchSize = 256;
+
+    static void retire(ControlBlock* cb) {
+        ThreadList* list = threadList();
+        if (list == nullptr) {
+            // Released after this thread's list was destroyed, e.g. by a
+            // static destructor: there is nothing left to defer to.
+            reclaimControlBlock<void>(cb);
+            return;
+        }
+        list->blocks.push_back(cb);
+        uint64_t requests = flushRequests().load(std::memory_order_relaxed);
+        if (list->blocks.size() >= kBatchSize ||
+            requests != list->requests_seen) {
+            list->requests_seen = requests;
+            list->flush();
+        }
+    }
+
+    // Makes every thread publish its buffered blocks on its next retire,
+    // however few there are.
+    static void requestFlush() {
+        flushRequests().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Publishes the calling thread's retired blocks and reclaims everything
+    // published so far, including blocks retired on other threads.
+    static void drain() {
+        flushThreadList();
+        reclaimPublished();
+    }
+
+    static void reclaimPublished() {
+        std::atomic<Batch*>& head = published();
+        Batch* batch = head.exchange(nullptr, std::memory_order_acquire);
+        while (batch != nullptr) {
+            for (ControlBlock* cb : batch->blocks) {
+                reclaimControlBlock<void>(cb);
+            }
+            Batch* next = batch->next;
+            delete batch;
+            batch = next;
+            if (batch == nullptr) {
+                // Destructors run above may have retired further blocks.
+                flushThreadList();
+                batch = head.exchange(nullptr, std::memory_order_acquire);
+            }
+        }
+    }
+
+  private:
+    struct Batch {
+        Batch* next = nullptr;
+        std::vector<ControlBlock*> blocks;
+    };
+
+    struct ThreadList {
+        std::vector<ControlBlock*> blocks;
+        uint64_t requests_seen = 0;
+
+        void flush() {
+            if (blocks.empty()) {
+                return;
+            }
+            auto* batch = new Batch();
+            batch->blocks.swap(blocks);
+            std::atomic<Batch*>& head = published();
+            batch->next = head.load(std::memory_order_relaxed);
+            while (!head.compare_exchange_weak(batch->next, batch,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+            }
+        }
+
+        ~ThreadList() {
+            flush();
+            threadLocalDestroyed<ThreadList>() = true;
+        }
+    };
+
+    static std::atomic<Batch*>& published() {
+        static std::atomic<Batch*> head{nullptr};
+        return head;
+    }
+
+    static std::atomic<uint64_t>& flushRequests() {
+        static std::atomic<uint64_t> requests{0};
+        return requests;
+    }
+
+    // Null once the calling thread's list has been destroyed.
+    static ThreadList* threadList() {
+        if (threadLocalDestroyed<ThreadList>()) {
+            return nullptr;
+        }
+        thread_local ThreadList list;
+        return &list;
+    }
+
+    static void flushThreadList() {
+        if (ThreadList* list = threadList()) {
+            list->flush();
+        }
+    }
+};
+
+inline void drainRetired() {
+    DeferredPolicy::drain();
+}
+
+// Background thread that periodically reclaims published batches. Each
+// pass also asks the threads to publish what they buffered, which they do
+// on their next retire, so a few dropped objects are not held until a
+// batch fills up. A thread that retires nothing more keeps its blocks
+// until it calls drainRetired() or exits.
+class DeferredReclaimer {
+  private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+
+  public:
+    explicit DeferredReclaimer(
+        std::chrono::milliseconds interval = std::chrono::milliseconds(1))
+        : worker([this, interval] {
+              std::unique_lock<std::mutex> lock(mutex);
+              while (!stopping) {
+                  wake.wait_for(lock, interval);
+                  lock.unlock();
+                  DeferredPolicy::requestFlush();
+                  DeferredPolicy::reclaimPublished();
+                  lock.lock();
+              }
+          }) {}
+
+    DeferredReclaimer(const DeferredReclaimer&) = delete;
+    DeferredReclaimer& operator=(const DeferredReclaimer&) = delete;
+
+    ~DeferredReclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+        DeferredPolicy::reclaimPublished();
+    }
+};
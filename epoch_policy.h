@@ -0,0 +1,239 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "smart_pointers.h"
+#include "thread_teardown.h"
+
+// Atomic counts with epoch-based reclamation. Dropping the last SharedPtr
+// retires the control block stamped with the current global epoch; it is
+// destroyed only after the epoch has advanced twice, which cannot happen
+// while a thread is still inside a critical section that began before the
+// retirement. WeakPtr::protect() opens such a section, so the object it
+// returns stays valid for the guard's lifetime without any count update.
+// Blocks released once the thread's thread-locals are destroyed, such as
+// by destructors of statics, are reclaimed as soon as no section can see
+// them, and otherwise by the next thread that reclaims.
+struct EpochPolicy : AtomicPolicy {
+    using ControlBlock = BaseControlBlock<EpochPolicy>;
+
+    static constexpr size_t kReclaimInterval = 64;
+
+    static void enter() {
+        Participant& self = participant();
+        if (self.nesting++ == 0) {
+            self.epoch.store(global().load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+            // Orders the announcement before the caller's load of the
+            // shared count, paired with the fence in retire(): either the
+            // caller sees the count at zero or tryAdvance() sees it active.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static void exit() {
+        Participant& self = participant();
+        if (--self.nesting == 0) {
+            self.epoch.store(kInactive, std::memory_order_release);
+        }
+    }
+
+    static void retire(ControlBlock* cb) {
+        Participant& self = participant();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t stamp = global().load(std::memory_order_seq_cst);
+        self.retired.push_back(Retired{cb, stamp});
+        if (threadLocalDestroyed<Registration>()) {
+            // Nothing reclaims at this thread's exit any more: advance as
+            // far as the other threads allow, destroy what is safe now and
+            // leave the rest to whichever thread reclaims next.
+            tryAdvance();
+            self.reclaim();
+            self.abandon();
+        } else if (self.retired.size() % kReclaimInterval == 0) {
+            self.reclaim();
+        }
+    }
+
+    // Advances the epoch if possible and destroys what the calling thread
+    // (or an exited thread) retired that no critical section can still see.
+    static void reclaim() {
+        participant().reclaim();
+    }
+
+  private:
+    static constexpr uint64_t kInactive = ~uint64_t{0};
+
+    struct Retired {
+        ControlBlock* cb;
+        uint64_t stamp;
+    };
+
+    struct Participant {
+        std::atomic<uint64_t> epoch{kInactive};
+        std::atomic<bool> in_use{true};
+        Participant* next = nullptr;
+        size_t nesting = 0;
+        std::vector<Retired> retired;
+
+        void reclaim() {
+            tryAdvance();
+            adoptOrphans(retired);
+            uint64_t now = global().load(std::memory_order_seq_cst);
+            std::vector<Retired> ready;
+            std::vector<Retired> waiting;
+            for (const Retired& entry : retired) {
+                (entry.stamp + 2 <= now ? ready : waiting).push_back(entry);
+            }
+            retired.swap(waiting);
+            // Destructors may retire further blocks onto `retired`. The
+            // retired blocks keep the weak reference of their former owners.
+            for (const Retired& entry : ready) {
+                reclaimControlBlock<void>(entry.cb);
+            }
+        }
+
+        void abandon() {
+            if (!retired.empty()) {
+                std::lock_guard<std::mutex> lock(orphanMutex());
+                orphans().insert(orphans().end(), retired.begin(),
+                                 retired.end());
+                retired.clear();
+            }
+        }
+    };
+
+    struct Registration {
+        Participant* self;
+
+        Registration() : self(acquire()) {}
+
+        ~Registration() {
+            self->reclaim();
+            self->abandon();
+            self->in_use.store(false, std::memory_order_release);
+            threadLocalDestroyed<Registration>() = true;
+        }
+    };
+
+    static std::atomic<uint64_t>& global() {
+        static std::atomic<uint64_t> epoch{0};
+        return epoch;
+    }
+
+    // Participants are recycled between threads but never freed, so the
+    // advancing thread can always walk the list.
+    static std::atomic<Participant*>& participants() {
+        static std::atomic<Participant*> head{nullptr};
+        return head;
+    }
+
+    // Never destroyed, so that destructors of statics can still retire.
+    static std::mutex& orphanMutex() {
+        static auto* mutex = new std::mutex();
+        return *mutex;
+    }
+
+    static std::vector<Retired>& orphans() {
+        static auto* retired = new std::vector<Retired>();
+        return *retired;
+    }
+
+    static Participant* acquire() {
+        std::atomic<Participant*>& head = participants();
+        for (Participant* p = head.load(std::memory_order_acquire);
+             p != nullptr; p = p->next) {
+            bool free = false;
+            if (p->in_use.compare_exchange_strong(free, true,
+                                                  std::memory_order_acquire)) {
+                return p;
+            }
+        }
+        auto* p = new Participant();
+        p->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(p->next, p,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+        }
+        return p;
+    }
+
+    static Participant& participant() {
+        if (threadLocalDestroyed<Registration>()) {
+            // E.g. destructors of statics on the main thread: keep a
+            // participant for good, as nothing would release it.
+            thread_local Participant* detached = acquire();
+            return *detached;
+        }
+        thread_local Registration registration;
+        return *registration.self;
+    }
+
+    static void adoptOrphans(std::vector<Retired>& retired) {
+        std::lock_guard<std::mutex> lock(orphanMutex());
+        retired.insert(retired.end(), orphans().begin(), orphans().end());
+        orphans().clear();
+    }
+
+    static void tryAdvance() {
+        uint64_t current = global().load(std::memory_order_seq_cst);
+        for (Participant* p = participants().load(std::memory_order_acquire);
+             p != nullptr; p = p->next) {
+            uint64_t announced = p->epoch.load(std::memory_order_seq_cst);
+            if (announced != kInactive && announced != current) {
+                return;
+            }
+        }
+        global().compare_exchange_strong(current, current + 1,
+                                         std::memory_order_seq_cst);
+    }
+};
+
+template <typename T, typename Policy>
+class ProtectedPtr {
+  public:
+    using element_type = std::remove_extent_t<T>;
+
+  private:
+    element_type* ptr = nullptr;
+
+  public:
+    ProtectedPtr(element_type* object, BaseControlBlock<Policy>* cb) {
+        static_assert(std::is_same_v<Policy, EpochPolicy>,
+                      "protect() needs epoch-based reclamation");
+        Policy::enter();
+        if (cb != nullptr && Policy::load(cb->shared_count) != 0) {
+            ptr = object;
+        }
+    }
+
+    ProtectedPtr(const ProtectedPtr&) = delete;
+    ProtectedPtr& operator=(const ProtectedPtr&) = delete;
+
+    ~ProtectedPtr() {
+        Policy::exit();
+    }
+
+    explicit operator bool() const {
+        return ptr != nullptr;
+    }
+
+    element_type& operator*() const {
+        return *ptr;
+    }
+
+    element_type* operator->() const {
+        return ptr;
+    }
+
+    element_type* get() const {
+        return ptr;
+    }
+};
+
+inline void reclaimEpochRetired() {
+    EpochPolicy::reclaim();
+}
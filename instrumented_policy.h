@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define SMART_POINTERS_HAS_BACKTRACE 1
+#endif
+
+#include "smart_pointers.h"
+
+enum class RefEvent {
+    shared_increment,
+    shared_decrement,
+    weak_increment,
+    weak_decrement,
+    lock_success,
+    lock_failure,
+    allocate,
+    deallocate,
+};
+
+inline constexpr size_t kRefEventCount = 8;
+
+inline const char* refEventName(RefEvent event) {
+    static const char* const names[kRefEventCount] = {
+        "shared_increment", "shared_decrement", "weak_increment",
+        "weak_decrement",   "lock_success",     "lock_failure",
+        "allocate",         "deallocate",
+    };
+    return names[static_cast<size_t>(event)];
+}
+
+// Default hooks: per-thread event counters, and optionally a backtrace of
+// every Nth event on each thread, aggregated by call stack so the hottest
+// copies can be found. Counters are plain stores on the recording thread;
+// totals() sums all threads, including ones that have exited.
+class CountingHooks {
+  public:
+    static constexpr size_t kFrames = 8;
+
+    using Totals = std::array<size_t, kRefEventCount>;
+
+    struct CallSite {
+        RefEvent event;
+        std::vector<void*> frames;
+        size_t samples;
+    };
+
+    static void record(RefEvent event) {
+        ThreadCounters& counters = threadCounters();
+        std::atomic<size_t>& counter =
+            counters.counts[static_cast<size_t>(event)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+        size_t period = samplePeriod().load(std::memory_order_relaxed);
+        if (period != 0 && ++counters.since_sample >= period) {
+            counters.since_sample = 0;
+            sample(event);
+        }
+    }
+
+    static Totals totals() {
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        Totals sum = all.exited;
+        for (ThreadCounters* counters : all.live) {
+            for (size_t i = 0; i < kRefEventCount; ++i) {
+                sum[i] += counters->counts[i].load(std::memory_order_relaxed);
+            }
+        }
+        return sum;
+    }
+
+    // Captures a call stack on every `period`-th event of each thread; zero
+    // turns sampling off.
+    static void setSamplePeriod(size_t period) {
+        samplePeriod().store(period, std::memory_order_relaxed);
+    }
+
+    static std::vector<CallSite> hottestCallSites(size_t limit) {
+        std::vector<CallSite> sites;
+        {
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            for (const auto& [key, samples] : all.samples) {
+                sites.push_back(CallSite{key.first, key.second, samples});
+            }
+        }
+        std::sort(sites.begin(), sites.end(),
+                  [](const CallSite& lhs, const CallSite& rhs) {
+                      return lhs.samples > rhs.samples;
+                  });
+        if (sites.size() > limit) {
+            sites.resize(limit);
+        }
+        return sites;
+    }
+
+    static void printCallSites(std::ostream& out, size_t limit) {
+        for (const CallSite& site : hottestCallSites(limit)) {
+            out << site.samples << " x " << refEventName(site.event) << '\n';
+#ifdef SMART_POINTERS_HAS_BACKTRACE
+            char** symbols = backtrace_symbols(
+                site.frames.data(), static_cast<int>(site.frames.size()));
+            for (size_t i = 0; i < site.frames.size(); ++i) {
+                out << "    " << (symbols ? symbols[i] : "?") << '\n';
+            }
+            free(symbols);
+#endif
+        }
+    }
+
+  private:
+    struct ThreadCounters {
+        std::atomic<size_t> counts[kRefEventCount] = {};
+        size_t since_sample = 0;
+
+        ThreadCounters() {
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.live.push_back(this);
+        }
+
+        ~ThreadCounters() {
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            for (size_t i = 0; i < kRefEventCount; ++i) {
+                all.exited[i] += counts[i].load(std::memory_order_relaxed);
+            }
+            all.live.erase(
+                std::find(all.live.begin(), all.live.end(), this));
+        }
+    };
+
+    using SampleKey = std::pair<RefEvent, std::vector<void*>>;
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<ThreadCounters*> live;
+        Totals exited = {};
+        std::map<SampleKey, size_t> samples;
+    };
+
+    // Never destroyed: thread counters may fold into it during exit.
+    static Registry& registry() {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+
+    static std::atomic<size_t>& samplePeriod() {
+        static std::atomic<size_t> period{0};
+        return period;
+    }
+
+    static ThreadCounters& threadCounters() {
+        thread_local ThreadCounters counters;
+        return counters;
+    }
+
+    // Kept out of line so that the first frame it skips is always its own;
+    // record() is usually inlined into the call site.
+    [[gnu::noinline]] static void sample(RefEvent event) {
+        std::vector<void*> frames;
+#ifdef SMART_POINTERS_HAS_BACKTRACE
+        void* buffer[kFrames + 1];
+        int depth = backtrace(buffer, static_cast<int>(kFrames + 1));
+        for (int i = 1; i < depth; ++i) {
+            frames.push_back(buffer[i]);
+        }
+#endif
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        ++all.samples[SampleKey(event, std::move(frames))];
+    }
+};
+
+// Wraps the counts of Base and reports every operation on them to
+// Hooks::record(RefEvent). Pointers that do not use this policy pay
+// nothing. Base is LocalPolicy or AtomicPolicy; policies that recover their
+// own control block type from a count cannot be wrapped.
+template <typename Base = AtomicPolicy, typename Hooks = CountingHooks>
+struct InstrumentedPolicy {
+    struct SharedCount {
+        typename Base::count_type value;
+
+        explicit SharedCount(size_t initial) : value(initial) {}
+    };
+
+    struct WeakCount {
+        typename Base::weak_count_type value;
+
+        explicit WeakCount(size_t initial) : value(initial) {}
+    };
+
+    using count_type = SharedCount;
+    using weak_count_type = WeakCount;
+
+    static void increment(count_type& count) {
+        Hooks::record(RefEvent::shared_increment);
+        Base::increment(count.value);
+    }
+
+    static size_t decrement(count_type& count) {
+        Hooks::record(RefEvent::shared_decrement);
+        return Base::decrement(count.value);
+    }
+
+    static size_t load(const count_type& count) {
+        return Base::load(count.value);
+    }
+
+    // Only WeakPtr::lock() and the sharedFromThis() built on it take this
+    // path.
+    static bool incrementIfNonZero(count_type& count) {
+        bool locked = Base::incrementIfNonZero(count.value);
+        Hooks::record(locked ? RefEvent::lock_success
+                             : RefEvent::lock_failure);
+        return locked;
+    }
+
+    static void increment(weak_count_type& count) {
+        Hooks::record(RefEvent::weak_increment);
+        Base::increment(count.value);
+    }
+
+    static size_t decrement(weak_count_type& count) {
+        Hooks::record(RefEvent::weak_decrement);
+        return Base::decrement(count.value);
+    }
+
+    static size_t load(const weak_count_type& count) {
+        return Base::load(count.value);
+    }
+
+    static bool incrementIfNonZero(weak_count_type& count) {
+        return Base::incrementIfNonZero(count.value);
+    }
+
+    template <typename T>
+    static void onAllocate(BaseControlBlock<InstrumentedPolicy>*, const T*,
+                           size_t) {
+        Hooks::record(RefEvent::allocate);
+    }
+
+    static void onDeallocate(BaseControlBlock<InstrumentedPolicy>*) {
+        Hooks::record(RefEvent::deallocate);
+    }
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <thread>
+
+#include "smart_pointers.h"
+
+// Counts that start out thread-local and can be switched to atomic once.
+// In local mode every update is a relaxed load and store on the creating
+// thread, about as cheap as LocalPolicy; share() sets a mode bit in both
+// counts, after which they behave like AtomicPolicy. Debug builds check
+// that a block in local mode is only touched by the thread that made it.
+struct UpgradablePolicy {
+    static constexpr size_t kShared = size_t{1} << (sizeof(size_t) * 8 - 1);
+
+    struct WeakCount {
+        std::atomic<size_t> word;
+
+        explicit WeakCount(size_t initial) : word(initial) {}
+    };
+
+    struct SharedCount : WeakCount {
+        // Present in every build mode, so that the block layout does not
+        // depend on NDEBUG; only debug builds check it.
+        std::thread::id owner = std::this_thread::get_id();
+
+        explicit SharedCount(size_t initial) : WeakCount(initial) {}
+
+        void checkOwner() const {
+#ifndef NDEBUG
+            assert((word.load(std::memory_order_relaxed) & kShared) != 0 ||
+                   owner == std::this_thread::get_id());
+#endif
+        }
+    };
+
+    using count_type = SharedCount;
+    using weak_count_type = WeakCount;
+
+    static void increment(count_type& count) {
+        count.checkOwner();
+        increment(static_cast<WeakCount&>(count));
+    }
+
+    static size_t decrement(count_type& count) {
+        count.checkOwner();
+        return decrement(static_cast<WeakCount&>(count));
+    }
+
+    static size_t load(const count_type& count) {
+        return load(static_cast<const WeakCount&>(count));
+    }
+
+    static bool incrementIfNonZero(count_type& count) {
+        count.checkOwner();
+        return incrementIfNonZero(static_cast<WeakCount&>(count));
+    }
+
+    static void increment(weak_count_type& count) {
+        size_t word = count.word.load(std::memory_order_relaxed);
+        if ((word & kShared) == 0) {
+            count.word.store(word + 1, std::memory_order_relaxed);
+            return;
+        }
+        count.word.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static size_t decrement(weak_count_type& count) {
+        size_t word = count.word.load(std::memory_order_relaxed);
+        if ((word & kShared) == 0) {
+            count.word.store(word - 1, std::memory_order_relaxed);
+            return word - 1;
+        }
+        return (count.word.fetch_sub(1, std::memory_order_acq_rel) - 1) &
+               ~kShared;
+    }
+
+    static size_t load(const weak_count_type& count) {
+        return count.word.load(std::memory_order_acquire) & ~kShared;
+    }
+
+    static bool incrementIfNonZero(weak_count_type& count) {
+        size_t word = count.word.load(std::memory_order_relaxed);
+        if ((word & kShared) == 0) {
+            if (word == 0) {
+                return false;
+            }
+            count.word.store(word + 1, std::memory_order_relaxed);
+            return true;
+        }
+        while ((word & ~kShared) != 0) {
+            if (count.word.compare_exchange_weak(word, word + 1,
+                                                 std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs on the owning thread while no other thread can see the block.
+    template <typename T>
+    static void upgrade(const SharedPtr<T, UpgradablePolicy>& shared) {
+        BaseControlBlock<UpgradablePolicy>* cb = shared.cb;
+        if (cb == nullptr || (cb->shared_count.word.load(
+                                  std::memory_order_relaxed) &
+                              kShared) != 0) {
+            return;
+        }
+        cb->shared_count.checkOwner();
+        cb->weak_count.word.fetch_or(kShared, std::memory_order_relaxed);
+        cb->shared_count.word.fetch_or(kShared, std::memory_order_release);
+    }
+};
+
+template <typename T>
+using LocalSharedPtr = SharedPtr<T, UpgradablePolicy>;
+
+template <typename T>
+using LocalWeakPtr = WeakPtr<T, UpgradablePolicy>;
+
+template <typename T, typename... Args>
+LocalSharedPtr<T> makeLocalShared(Args&&... args) {
+    return makeShared<T, UpgradablePolicy>(std::forward<Args>(args)...);
+}
+
+template <typename T>
+class SharedModePtr;
+
+// Switches the block of `local` to atomic counts and returns a reference
+// that may be handed to other threads, as may every further copy. Must be
+// called on the thread that created the object; a block that is already
+// shared is left as it is.
+template <typename T>
+SharedModePtr<T> share(const LocalSharedPtr<T>& local) {
+    UpgradablePolicy::upgrade(local);
+    return SharedModePtr<T>(local);
+}
+
+// A reference to an object whose block share() has switched to atomic
+// counts, the only form of LocalSharedPtr meant to cross threads. A plain
+// LocalSharedPtr copied to another thread is not caught in release builds,
+// so interfaces that take objects from other threads should take this.
+template <typename T>
+class SharedModePtr {
+  public:
+    using element_type = typename LocalSharedPtr<T>::element_type;
+
+    SharedModePtr() {}
+
+    // A pointer for use on the calling thread; its copies stay atomic.
+    LocalSharedPtr<T> local() const {
+        return pointer;
+    }
+
+    size_t use_count() const {
+        return pointer.use_count();
+    }
+
+    void reset() noexcept {
+        pointer.reset();
+    }
+
+    element_type& operator*() const {
+        return *pointer;
+    }
+
+    element_type* operator->() const {
+        return pointer.get();
+    }
+
+    element_type* get() const {
+        return pointer.get();
+    }
+
+  private:
+    explicit SharedModePtr(const LocalSharedPtr<T>& shared)
+        : pointer(shared) {}
+
+    LocalSharedPtr<T> pointer;
+
+    friend SharedModePtr share<T>(const LocalSharedPtr<T>& local);
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "thread_teardown.h"
+
+// Size-class pool for small, short-lived allocations such as control
+// blocks. Each thread keeps its own free lists; lists that grow past
+// kBatchSize * 2 hand a batch back to a shared central list, which is also
+// where memory freed on other threads finds its way back to allocators.
+class ControlBlockPool {
+  public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kClasses = kMaxSize / kGranularity;
+    static constexpr size_t kBatchSize = 64;
+
+    static bool handles(size_t bytes, size_t alignment) {
+        return bytes <= kMaxSize && alignment <= kGranularity;
+    }
+
+    static void* allocate(size_t bytes) {
+        if (ThreadCache* cache = threadCache()) {
+            return cache->allocate(sizeClass(bytes));
+        }
+        return central().popNode(sizeClass(bytes));
+    }
+
+    static void deallocate(void* pointer, size_t bytes) {
+        if (ThreadCache* cache = threadCache()) {
+            cache->deallocate(pointer, sizeClass(bytes));
+            return;
+        }
+        central().pushNode(sizeClass(bytes), pointer);
+    }
+
+  private:
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct Batch {
+        FreeNode* head;
+        size_t count;
+    };
+
+    struct Central {
+        std::mutex mutex[kClasses];
+        std::vector<Batch> batches[kClasses];
+        std::mutex slab_mutex;
+        std::vector<void*> slabs;
+
+        Batch pop(size_t cls) {
+            {
+                std::lock_guard<std::mutex> lock(mutex[cls]);
+                if (!batches[cls].empty()) {
+                    Batch batch = batches[cls].back();
+                    batches[cls].pop_back();
+                    return batch;
+                }
+            }
+            return carve(cls);
+        }
+
+        void push(size_t cls, Batch batch) {
+            std::lock_guard<std::mutex> lock(mutex[cls]);
+            batches[cls].push_back(batch);
+        }
+
+        // Single nodes, for threads whose cache has been destroyed.
+        void* popNode(size_t cls) {
+            Batch batch = pop(cls);
+            FreeNode* node = batch.head;
+            if (batch.count > 1) {
+                push(cls, Batch{node->next, batch.count - 1});
+            }
+            return node;
+        }
+
+        void pushNode(size_t cls, void* pointer) {
+            auto* node = static_cast<FreeNode*>(pointer);
+            node->next = nullptr;
+            push(cls, Batch{node, 1});
+        }
+
+        Batch carve(size_t cls) {
+            size_t size = (cls + 1) * kGranularity;
+            auto* slab = static_cast<unsigned char*>(
+                ::operator new(size * kBatchSize));
+            {
+                std::lock_guard<std::mutex> lock(slab_mutex);
+                slabs.push_back(slab);
+            }
+            FreeNode* head = nullptr;
+            for (size_t i = kBatchSize; i > 0; --i) {
+                auto* node =
+                    reinterpret_cast<FreeNode*>(slab + (i - 1) * size);
+                node->next = head;
+                head = node;
+            }
+            return Batch{head, kBatchSize};
+        }
+    };
+
+    struct ThreadCache {
+        FreeNode* heads[kClasses] = {};
+        size_t counts[kClasses] = {};
+
+        void* allocate(size_t cls) {
+            if (heads[cls] == nullptr) {
+                Batch batch = central().pop(cls);
+                heads[cls] = batch.head;
+                counts[cls] = batch.count;
+            }
+            FreeNode* node = heads[cls];
+            heads[cls] = node->next;
+            --counts[cls];
+            return node;
+        }
+
+        void deallocate(void* pointer, size_t cls) {
+            auto* node = static_cast<FreeNode*>(pointer);
+            node->next = heads[cls];
+            heads[cls] = node;
+            if (++counts[cls] >= kBatchSize * 2) {
+                central().push(cls, split(cls, kBatchSize));
+            }
+        }
+
+        Batch split(size_t cls, size_t count) {
+            FreeNode* head = heads[cls];
+            FreeNode* tail = head;
+            for (size_t i = 1; i < count; ++i) {
+                tail = tail->next;
+            }
+            heads[cls] = tail->next;
+            tail->next = nullptr;
+            counts[cls] -= count;
+            return Batch{head, count};
+        }
+
+        ~ThreadCache() {
+            for (size_t cls = 0; cls < kClasses; ++cls) {
+                if (counts[cls] != 0) {
+                    central().push(cls, split(cls, counts[cls]));
+                }
+            }
+            threadLocalDestroyed<ThreadCache>() = true;
+        }
+    };
+
+    static size_t sizeClass(size_t bytes) {
+        return bytes == 0 ? 0 : (bytes - 1) / kGranularity;
+    }
+
+    // Never destroyed: thread caches may flush into it during exit.
+    static Central& central() {
+        static Central* instance = new Central();
+        return *instance;
+    }
+
+    // Null once the calling thread's cache has been destroyed, e.g. for
+    // blocks freed by thread-locals or statics built before it; those go
+    // straight to the central list.
+    static ThreadCache* threadCache() {
+        if (threadLocalDestroyed<ThreadCache>()) {
+            return nullptr;
+        }
+        thread_local ThreadCache cache;
+        return &cache;
+    }
+};
+
+// Standard allocator over ControlBlockPool. Suitable for the Alloc
+// parameter of allocateShared and SharedPtr(U*, Deleter, Alloc); requests
+// the pool cannot serve fall through to ::operator new.
+template <typename T>
+class PoolAllocator {
+  public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (ControlBlockPool::handles(n * sizeof(T), alignof(T))) {
+            return static_cast<T*>(ControlBlockPool::allocate(n * sizeof(T)));
+        }
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+    }
+
+    void deallocate(T* pointer, size_t n) {
+        if (ControlBlockPool::handles(n * sizeof(T), alignof(T))) {
+            ControlBlockPool::deallocate(pointer, n * sizeof(T));
+            return;
+        }
+        ::operator delete(pointer, std::align_val_t(alignof(T)));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const {
+        return false;
+    }
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "smart_pointers.h"
+
+// Bounded lock-free queues that carry SharedPtrs as the single words from
+// SharedPtr::release(), so a hand-off moves one word through a slot and
+// never touches the counts. Capacities are rounded up to a power of two.
+// Whatever is still queued is released when the queue is destroyed.
+
+inline size_t queueCapacity(size_t capacity) {
+    size_t rounded = 2;
+    while (rounded < capacity) {
+        rounded *= 2;
+    }
+    return rounded;
+}
+
+// One producer thread and one consumer thread.
+template <typename T, typename Policy = AtomicPolicy>
+class SpscSharedPtrQueue {
+  public:
+    explicit SpscSharedPtrQueue(size_t capacity)
+        : mask(queueCapacity(capacity) - 1),
+          slots(new uintptr_t[mask + 1]) {}
+
+    SpscSharedPtrQueue(const SpscSharedPtrQueue&) = delete;
+    SpscSharedPtrQueue& operator=(const SpscSharedPtrQueue&) = delete;
+
+    ~SpscSharedPtrQueue() {
+        SharedPtr<T, Policy> value;
+        while (tryPop(value)) {
+        }
+    }
+
+    // Leaves `value` as it was when the queue is full.
+    bool tryPush(SharedPtr<T, Policy>& value) {
+        size_t tail = producer.tail.load(std::memory_order_relaxed);
+        if (tail - producer.cached_head > mask) {
+            producer.cached_head =
+                consumer.head.load(std::memory_order_acquire);
+            if (tail - producer.cached_head > mask) {
+                return false;
+            }
+        }
+        slots[tail & mask] = value.release();
+        producer.tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPush(SharedPtr<T, Policy>&& value) {
+        return tryPush(value);
+    }
+
+    bool tryPop(SharedPtr<T, Policy>& value) {
+        size_t head = consumer.head.load(std::memory_order_relaxed);
+        if (head == consumer.cached_tail) {
+            consumer.cached_tail =
+                producer.tail.load(std::memory_order_acquire);
+            if (head == consumer.cached_tail) {
+                return false;
+            }
+        }
+        auto popped = SharedPtr<T, Policy>::adoptRaw(slots[head & mask]);
+        consumer.head.store(head + 1, std::memory_order_release);
+        value = std::move(popped);
+        return true;
+    }
+
+  private:
+    // Each side caches the other's index and rereads it only when the
+    // queue looks full or empty.
+    struct alignas(kCacheLineSize) Producer {
+        std::atomic<size_t> tail{0};
+        size_t cached_head = 0;
+    };
+
+    struct alignas(kCacheLineSize) Consumer {
+        std::atomic<size_t> head{0};
+        size_t cached_tail = 0;
+    };
+
+    const size_t mask;
+    std::unique_ptr<uintptr_t[]> slots;
+    Producer producer;
+    Consumer consumer;
+};
+
+// Any number of producers and consumers. Each slot carries a sequence
+// number that says whose turn it is, so a push or pop claims its position
+// with one compare-and-swap and publishes it with one store.
+template <typename T, typename Policy = AtomicPolicy>
+class MpmcSharedPtrQueue {
+  public:
+    explicit MpmcSharedPtrQueue(size_t capacity)
+        : mask(queueCapacity(capacity) - 1), slots(new Slot[mask + 1]) {
+        for (size_t i = 0; i <= mask; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcSharedPtrQueue(const MpmcSharedPtrQueue&) = delete;
+    MpmcSharedPtrQueue& operator=(const MpmcSharedPtrQueue&) = delete;
+
+    ~MpmcSharedPtrQueue() {
+        SharedPtr<T, Policy> value;
+        while (tryPop(value)) {
+        }
+    }
+
+    // Leaves `value` as it was when the queue is full.
+    bool tryPush(SharedPtr<T, Policy>& value) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        // Fail before release(), which may allocate a box for `value`.
+        if (isFull(position)) {
+            return false;
+        }
+        uintptr_t word = value.release();
+        while (true) {
+            Slot& slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            auto lag = static_cast<intptr_t>(sequence - position);
+            if (lag == 0) {
+                if (tail.compare_exchange_weak(position, position + 1,
+                                               std::memory_order_relaxed)) {
+                    slot.word = word;
+                    slot.sequence.store(position + 1,
+                                        std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                value = SharedPtr<T, Policy>::adoptRaw(word);
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPush(SharedPtr<T, Policy>&& value) {
+        return tryPush(value);
+    }
+
+    bool tryPop(SharedPtr<T, Policy>& value) {
+        size_t position = head.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            auto lag = static_cast<intptr_t>(sequence - (position + 1));
+            if (lag == 0) {
+                if (head.compare_exchange_weak(position, position + 1,
+                                               std::memory_order_relaxed)) {
+                    auto popped = SharedPtr<T, Policy>::adoptRaw(slot.word);
+                    slot.sequence.store(position + mask + 1,
+                                        std::memory_order_release);
+                    value = std::move(popped);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+  private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        uintptr_t word;
+    };
+
+    // The slot at `position` still holds the item from one lap earlier.
+    bool isFull(size_t position) const {
+        size_t sequence =
+            slots[position & mask].sequence.load(std::memory_order_acquire);
+        return static_cast<intptr_t>(sequence - position) < 0;
+    }
+
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    alignas(kCacheLineSize) std::atomic<size_t> tail{0};
+    alignas(kCacheLineSize) std::atomic<size_t> head{0};
+};
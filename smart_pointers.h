@@ -2,189 +2,1088 @@
 
 #include <deque>
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <type_traits>
+#include <vector>
 
 template <typename U, typename V>
 using is_base_or_derived =
     std::enable_if_t<std::is_base_of_v<U, V> || std::is_same_v<U, V>>;
 
 template <typename T>
+inline constexpr bool is_array_of_unknown_bound =
+    std::is_array_v<T> && std::extent_v<T> == 0;
+
+template <typename T>
+inline constexpr bool is_array_of_known_bound =
+    std::is_array_v<T> && std::extent_v<T> != 0;
+
+// What SharedPtr(U*) deletes with by default; new T[N] gives a pointer to
+// the first element, so bounded arrays also take delete[].
+template <typename T>
+using default_deleter = std::default_delete<
+    std::conditional_t<std::is_array_v<T>, std::remove_extent_t<T>[], T>>;
+
+// Fixed rather than std::hardware_destructive_interference_size, whose
+// value depends on -mtune and would change the layout of padded blocks
+// between translation units. Override for targets with wider lines.
+#ifndef SMART_POINTERS_CACHE_LINE_SIZE
+#define SMART_POINTERS_CACHE_LINE_SIZE 64
+#endif
+
+inline constexpr size_t kCacheLineSize = SMART_POINTERS_CACHE_LINE_SIZE;
+
+// Set to 0 to give every (T, Deleter) its own ControlBlockRegular again,
+// e.g. to compare binary sizes, see ControlBlockErased.
+#ifndef SMART_POINTERS_ERASE_DELETERS
+#define SMART_POINTERS_ERASE_DELETERS 1
+#endif
+
+struct LocalPolicy {
+    using count_type = size_t;
+    using weak_count_type = size_t;
+
+    static void increment(count_type& count) {
+        ++count;
+    }
+
+    static size_t decrement(count_type& count) {
+        return --count;
+    }
+
+    static size_t load(const count_type& count) {
+        return count;
+    }
+
+    static bool incrementIfNonZero(count_type& count) {
+        if (count == 0) {
+            return false;
+        }
+        ++count;
+        return true;
+    }
+};
+
+struct AtomicPolicy {
+    using count_type = std::atomic<size_t>;
+    using weak_count_type = std::atomic<size_t>;
+
+    // A new reference is always made from an existing one, so the increment
+    // needs no ordering; the decrement that reaches zero must see every write
+    // made through the other owners before the object is destroyed.
+    static void increment(count_type& count) {
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static size_t decrement(count_type& count) {
+        return count.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    static size_t load(const count_type& count) {
+        return count.load(std::memory_order_acquire);
+    }
+
+    static bool incrementIfNonZero(count_type& count) {
+        size_t current = count.load(std::memory_order_relaxed);
+        while (current != 0) {
+            if (count.compare_exchange_weak(current, current + 1,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+template <typename T, typename Policy = AtomicPolicy>
 class WeakPtr;
 
+template <typename T>
+class AtomicSharedPtr;
+
+template <typename T, typename Policy = AtomicPolicy>
+class BorrowedPtr;
+
+template <typename T, typename Policy>
+class ProtectedPtr;
+
+template <typename T, typename Policy = AtomicPolicy>
+class EnableSharedFromThis;
+
+template <typename Policy, typename T>
+std::true_type derivesFromEnableSharedFromThis(
+    const EnableSharedFromThis<T, Policy>*);
+
+template <typename Policy>
+std::false_type derivesFromEnableSharedFromThis(...);
+
+enum class ControlBlockOp { destroy, deallocate, release };
+
+template <typename Policy>
+struct BaseControlBlock;
+
+template <typename T, typename = void>
+struct is_complete : std::false_type {};
+
+template <typename T>
+struct is_complete<T, std::void_t<decltype(sizeof(T))>> : std::true_type {};
+
+// Policies with static onAllocate(cb, object, bytes) and onDeallocate(cb)
+// are told about every control block created and freed, with the owned
+// object and the bytes allocated for both, see InstrumentedPolicy and
+// TrackedPolicy.
+template <typename Policy, typename = void>
+struct observes_allocation : std::false_type {};
+
+template <typename Policy>
+struct observes_allocation<
+    Policy, std::void_t<decltype(Policy::onAllocate(
+                std::declval<BaseControlBlock<Policy>*>(),
+                std::declval<const int*>(), size_t()))>> : std::true_type {};
+
+template <typename T, typename Policy>
+void notifyAllocate(BaseControlBlock<Policy>* cb, const T* object,
+                    size_t bytes) {
+    if constexpr (observes_allocation<Policy>::value) {
+        Policy::onAllocate(cb, object, bytes);
+    }
+}
+
+// Control blocks carry a single manager function instead of a vtable;
+// ControlBlockOp::release destroys the object and frees the block in one
+// dispatch when no weak references are left.
+//
+// All shared owners together hold one weak reference, dropped once the
+// object is destroyed, so the block is freed exactly when weak_count
+// reaches zero and no path has to look at both counts.
+template <typename Policy>
 struct BaseControlBlock {
-    size_t shared_count = 0;
-    size_t weak_count = 0;
+    using Manager = void (*)(BaseControlBlock*, ControlBlockOp);
+
+    typename Policy::count_type shared_count{0};
+    typename Policy::weak_count_type weak_count{1};
+    Manager manager;
+
+    explicit BaseControlBlock(Manager manager) : manager(manager) {}
+
+    BaseControlBlock(Manager manager, size_t weak)
+        : weak_count(weak), manager(manager) {}
+
+    // Blocks from makeImmortal() have no manager, since nothing ever
+    // releases them.
+    bool immortal() const {
+        return manager == nullptr;
+    }
+};
+
+// Copies of immortal pointers leave the counts alone, so their cache line
+// is only ever read; everything else pays one well-predicted branch.
+template <typename Policy>
+void acquireShared(BaseControlBlock<Policy>* cb) {
+    if (!cb->immortal()) {
+        Policy::increment(cb->shared_count);
+    }
+}
+
+template <typename Policy>
+void acquireWeak(BaseControlBlock<Policy>* cb) {
+    if (!cb->immortal()) {
+        Policy::increment(cb->weak_count);
+    }
+}
+
+// Stores a deleter or allocator as a base class when it is empty, so
+// stateless ones such as std::default_delete take no space in the block.
+template <typename T, size_t Index,
+          bool = std::is_empty_v<T> && !std::is_final_v<T>>
+struct CompressedMember {
+    T value;
+
+    explicit CompressedMember(const T& value) : value(value) {}
+
+    T& get() {
+        return value;
+    }
+};
+
+template <typename T, size_t Index>
+struct CompressedMember<T, Index, true> : T {
+    explicit CompressedMember(const T& value) : T(value) {}
 
-    virtual void destroy() = 0;
-    virtual void deallocate() = 0;
-    virtual ~BaseControlBlock() = default;
+    T& get() {
+        return *this;
+    }
 };
 
-template <typename T, typename Deleter, typename Alloc>
-struct ControlBlockRegular : BaseControlBlock {
+template <typename T, typename Deleter, typename Alloc, typename Policy>
+struct ControlBlockRegular : BaseControlBlock<Policy>,
+                             CompressedMember<Deleter, 0>,
+                             CompressedMember<Alloc, 1> {
     T* ptr = nullptr;
-    Deleter deleter;
-    Alloc alloc;
 
     ControlBlockRegular(T* pt, const Deleter& deleter, const Alloc& alloc)
-        : ptr(pt), deleter(deleter), alloc(alloc) {}
+        : BaseControlBlock<Policy>(&manage),
+          CompressedMember<Deleter, 0>(deleter),
+          CompressedMember<Alloc, 1>(alloc),
+          ptr(pt) {}
+
+    Deleter& deleter() {
+        return CompressedMember<Deleter, 0>::get();
+    }
+
+    Alloc& allocator() {
+        return CompressedMember<Alloc, 1>::get();
+    }
 
-    void destroy() override {
-        deleter(ptr);
+    static void manage(BaseControlBlock<Policy>* base, ControlBlockOp op) {
+        auto* self = static_cast<ControlBlockRegular*>(base);
+        if (op != ControlBlockOp::deallocate) {
+            self->destroy();
+        }
+        if (op != ControlBlockOp::destroy) {
+            self->deallocate();
+        }
+    }
+
+    void destroy() {
+        deleter()(ptr);
         ptr = nullptr;
     }
 
-    void deallocate() override {
+    void deallocate() {
         using allocTraits =
             typename std::allocator_traits<Alloc>::template rebind_traits<
-                ControlBlockRegular<T, Deleter, Alloc>>;
+                ControlBlockRegular<T, Deleter, Alloc, Policy>>;
         using allocType =
             typename std::allocator_traits<Alloc>::template rebind_alloc<
-                ControlBlockRegular<T, Deleter, Alloc>>;
-        allocType alloc_copy = alloc;
+                ControlBlockRegular<T, Deleter, Alloc, Policy>>;
+        allocType alloc_copy = allocator();
+        this->~ControlBlockRegular();
         allocTraits::deallocate(alloc_copy, this, 1);
     }
 };
 
-template <typename T, typename Alloc = std::allocator<T>>
-struct ControlBlockMakeShared : public BaseControlBlock {
-    T ptr;
-    Alloc alloc;
+// One block type for every pointer adopted with a stateless deleter and
+// std::allocator. Its layout, allocation and deallocation are the same for
+// all of them and instantiated once per policy; the only code generated
+// per type is the manager, a thunk that runs the deleter.
+template <typename Policy>
+struct ControlBlockErased : BaseControlBlock<Policy> {
+    using typename BaseControlBlock<Policy>::Manager;
+
+    void* ptr;
+
+    ControlBlockErased(void* ptr, Manager manager)
+        : BaseControlBlock<Policy>(manager), ptr(ptr) {}
+
+    [[gnu::noinline]] static ControlBlockErased* create(void* ptr,
+                                                        Manager manager) {
+        return new ControlBlockErased(ptr, manager);
+    }
+
+    [[gnu::noinline]] static void deallocate(BaseControlBlock<Policy>* base) {
+        delete static_cast<ControlBlockErased*>(base);
+    }
+
+    template <typename T, typename Deleter>
+    static void manage(BaseControlBlock<Policy>* base, ControlBlockOp op) {
+        auto* self = static_cast<ControlBlockErased*>(base);
+        if (op != ControlBlockOp::deallocate) {
+            Deleter()(static_cast<T*>(self->ptr));
+            self->ptr = nullptr;
+        }
+        if (op != ControlBlockOp::destroy) {
+            deallocate(self);
+        }
+    }
+};
+
+// Deleters that can be recreated at will instead of stored: empty,
+// trivially copyable and default constructible, like std::default_delete.
+template <typename Deleter, typename Alloc>
+struct erases_deleter
+    : std::bool_constant<
+          SMART_POINTERS_ERASE_DELETERS && std::is_empty_v<Deleter> &&
+          std::is_trivially_copyable_v<Deleter> &&
+          std::is_default_constructible_v<Deleter> &&
+          std::is_same_v<Alloc, std::allocator<typename Alloc::value_type>>> {
+};
+
+// With Padded set the object starts on its own cache line, so threads
+// writing to it do not contend with threads updating the counts.
+template <typename T, typename Alloc = std::allocator<T>,
+          typename Policy = AtomicPolicy, bool Padded = false>
+struct ControlBlockMakeShared : public BaseControlBlock<Policy>,
+                                CompressedMember<Alloc, 0> {
+    static constexpr size_t kObjectAlignment =
+        Padded && kCacheLineSize > alignof(T) ? kCacheLineSize : alignof(T);
+
+    union alignas(kObjectAlignment) {
+        T object;
+    };
 
     template <typename... Args>
     ControlBlockMakeShared(Alloc alloc, Args&&... args)
-        : ptr(std::forward<Args>(args)...), alloc(alloc) {}
-
-    void destroy() override {
+        : BaseControlBlock<Policy>(&manage), CompressedMember<Alloc, 0>(alloc) {
         using allocTraits = typename std::allocator_traits<
-            Alloc>::template rebind_traits<ControlBlockMakeShared<Alloc>>;
+            Alloc>::template rebind_traits<T>;
         using allocType = typename std::allocator_traits<
-            Alloc>::template rebind_alloc<ControlBlockMakeShared<Alloc>>;
+            Alloc>::template rebind_alloc<T>;
         allocType alloc_copy = alloc;
-        allocTraits::destroy(alloc_copy, &ptr);
+        allocTraits::construct(alloc_copy, &object,
+                               std::forward<Args>(args)...);
+        notifyAllocate(this, &object, sizeof(ControlBlockMakeShared));
+    }
+
+    ~ControlBlockMakeShared() {}
+
+    Alloc& allocator() {
+        return CompressedMember<Alloc, 0>::get();
     }
 
-    void deallocate() override {
+    static void manage(BaseControlBlock<Policy>* base, ControlBlockOp op) {
+        auto* self = static_cast<ControlBlockMakeShared*>(base);
+        if (op != ControlBlockOp::deallocate) {
+            self->destroy();
+        }
+        if (op != ControlBlockOp::destroy) {
+            self->deallocate();
+        }
+    }
+
+    void destroy() {
         using allocTraits = typename std::allocator_traits<
-            Alloc>::template rebind_traits<ControlBlockMakeShared<T, Alloc>>;
+            Alloc>::template rebind_traits<T>;
         using allocType = typename std::allocator_traits<
-            Alloc>::template rebind_alloc<ControlBlockMakeShared<T, Alloc>>;
-        allocType alloc_copy = alloc;
+            Alloc>::template rebind_alloc<T>;
+        allocType alloc_copy = allocator();
+        allocTraits::destroy(alloc_copy, &object);
+    }
+
+    void deallocate() {
+        using allocTraits =
+            typename std::allocator_traits<Alloc>::template rebind_traits<
+                ControlBlockMakeShared>;
+        using allocType =
+            typename std::allocator_traits<Alloc>::template rebind_alloc<
+                ControlBlockMakeShared>;
+        allocType alloc_copy = allocator();
+        this->~ControlBlockMakeShared();
         allocTraits::deallocate(alloc_copy, this, 1);
     }
 };
 
+template <size_t Alignment>
+struct alignas(Alignment) AlignedStorageUnit {
+    unsigned char bytes[Alignment];
+};
+
+// Holds `size` elements directly after the block header, so an array from
+// makeShared<T[]>(n) is a single allocation.
+template <typename T, typename Alloc, typename Policy>
+struct ControlBlockArray : BaseControlBlock<Policy>,
+                           CompressedMember<Alloc, 0> {
+    size_t size;
+
+    ControlBlockArray(const Alloc& alloc, size_t size)
+        : BaseControlBlock<Policy>(&manage),
+          CompressedMember<Alloc, 0>(alloc),
+          size(size) {}
+
+    Alloc& allocator() {
+        return CompressedMember<Alloc, 0>::get();
+    }
+
+    static constexpr size_t alignment() {
+        return alignof(T) > alignof(ControlBlockArray)
+                   ? alignof(T)
+                   : alignof(ControlBlockArray);
+    }
+
+    static constexpr size_t elementsOffset() {
+        return (sizeof(ControlBlockArray) + alignof(T) - 1) / alignof(T) *
+               alignof(T);
+    }
+
+    static size_t units(size_t size) {
+        return (elementsOffset() + size * sizeof(T) + alignment() - 1) /
+               alignment();
+    }
+
+    T* elements() {
+        return reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(this) +
+                                    elementsOffset());
+    }
+
+    template <bool ValueInit>
+    static ControlBlockArray* create(const Alloc& alloc, size_t size) {
+        using Unit = AlignedStorageUnit<alignment()>;
+        using unitTraits = typename std::allocator_traits<
+            Alloc>::template rebind_traits<Unit>;
+        using unitType = typename std::allocator_traits<
+            Alloc>::template rebind_alloc<Unit>;
+        using allocTraits = typename std::allocator_traits<
+            Alloc>::template rebind_traits<T>;
+        using allocType = typename std::allocator_traits<
+            Alloc>::template rebind_alloc<T>;
+
+        unitType unit_alloc = alloc;
+        Unit* storage = unitTraits::allocate(unit_alloc, units(size));
+        auto* block = new (storage) ControlBlockArray(alloc, size);
+
+        allocType alloc_copy = alloc;
+        T* first = block->elements();
+        size_t i = 0;
+        try {
+            for (; i < size; ++i) {
+                if constexpr (ValueInit) {
+                    allocTraits::construct(alloc_copy, first + i);
+                } else {
+                    new (first + i) T;
+                }
+            }
+        } catch (...) {
+            for (; i > 0; --i) {
+                allocTraits::destroy(alloc_copy, first + i - 1);
+            }
+            block->~ControlBlockArray();
+            unitTraits::deallocate(unit_alloc, storage, units(size));
+            throw;
+        }
+        notifyAllocate(block, first, units(size) * alignment());
+        return block;
+    }
+
+    static void manage(BaseControlBlock<Policy>* base, ControlBlockOp op) {
+        auto* self = static_cast<ControlBlockArray*>(base);
+        if (op != ControlBlockOp::deallocate) {
+            self->destroy();
+        }
+        if (op != ControlBlockOp::destroy) {
+            self->deallocate();
+        }
+    }
+
+    void destroy() {
+        using allocTraits = typename std::allocator_traits<
+            Alloc>::template rebind_traits<T>;
+        using allocType = typename std::allocator_traits<
+            Alloc>::template rebind_alloc<T>;
+        allocType alloc_copy = allocator();
+        T* first = elements();
+        for (size_t i = size; i > 0; --i) {
+            allocTraits::destroy(alloc_copy, first + i - 1);
+        }
+    }
+
+    void deallocate() {
+        using Unit = AlignedStorageUnit<alignment()>;
+        using unitTraits = typename std::allocator_traits<
+            Alloc>::template rebind_traits<Unit>;
+        using unitType = typename std::allocator_traits<
+            Alloc>::template rebind_alloc<Unit>;
+        unitType unit_alloc = allocator();
+        size_t count = units(size);
+        this->~ControlBlockArray();
+        unitTraits::deallocate(unit_alloc, reinterpret_cast<Unit*>(this),
+                               count);
+    }
+};
+
+// Holds an object that is never destroyed, for global registries and
+// interned constants handed out to many threads. The counts keep the
+// values of the first owner: a use count of one, never expired.
+template <typename T, typename Policy>
+struct ControlBlockImmortal : BaseControlBlock<Policy> {
+    union {
+        T object;
+    };
+
+    template <typename... Args>
+    explicit ControlBlockImmortal(Args&&... args)
+        : BaseControlBlock<Policy>(nullptr) {
+        new (&object) T(std::forward<Args>(args)...);
+    }
+
+    ~ControlBlockImmortal() {}
+};
+
+// One cell of a slab from makeSharedBatch(): a block with its object,
+// laid out back to back with the other cells of the batch. Each cell has
+// its own counts and is released on its own; the slab is freed with the
+// last of them.
+template <typename T, typename Alloc, typename Policy>
+struct ControlBlockBatch : BaseControlBlock<Policy> {
+    struct Slab : CompressedMember<Alloc, 0> {
+        // Cells not yet freed, plus one while the batch is being built.
+        std::atomic<size_t> cells{1};
+        size_t size;
+
+        Slab(const Alloc& alloc, size_t size)
+            : CompressedMember<Alloc, 0>(alloc), size(size) {}
+    };
+
+    Slab* slab;
+
+    union {
+        T object;
+    };
+
+    explicit ControlBlockBatch(Slab* slab)
+        : BaseControlBlock<Policy>(&manage), slab(slab) {}
+
+    ~ControlBlockBatch() {}
+
+    static constexpr size_t alignment() {
+        return alignof(Slab) > alignof(ControlBlockBatch)
+                   ? alignof(Slab)
+                   : alignof(ControlBlockBatch);
+    }
+
+    static constexpr size_t cellsOffset() {
+        return (sizeof(Slab) + alignof(ControlBlockBatch) - 1) /
+               alignof(ControlBlockBatch) * alignof(ControlBlockBatch);
+    }
+
+    static size_t units(size_t size) {
+        return (cellsOffset() + size * sizeof(ControlBlockBatch) +
+                alignment() - 1) /
+               alignment();
+    }
+
+    static ControlBlockBatch* cell(Slab* slab, size_t index) {
+        return reinterpret_cast<ControlBlockBatch*>(
+                   reinterpret_cast<unsigned char*>(slab) + cellsOffset()) +
+               index;
+    }
+
+    static Slab* allocateSlab(const Alloc& alloc, size_t size) {
+        using Unit = AlignedStorageUnit<alignment()>;
+        using unitTraits = typename std::allocator_traits<
+            Alloc>::template rebind_traits<Unit>;
+        using unitType = typename std::allocator_traits<
+            Alloc>::template rebind_alloc<Unit>;
+        unitType unit_alloc = alloc;
+        Unit* storage = unitTraits::allocate(unit_alloc, units(size));
+        return new (storage) Slab(alloc, size);
+    }
+
+    // Drops one cell, or the reference held while building the batch.
+    static void releaseSlab(Slab* slab) {
+        if (slab->cells.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        using Unit = AlignedStorageUnit<alignment()>;
+        using unitTraits = typename std::allocator_traits<
+            Alloc>::template rebind_traits<Unit>;
+        using unitType = typename std::allocator_traits<
+            Alloc>::template rebind_alloc<Unit>;
+        unitType unit_alloc = slab->get();
+        size_t count = units(slab->size);
+        slab->~Slab();
+        unitTraits::deallocate(unit_alloc, reinterpret_cast<Unit*>(slab),
+                               count);
+    }
+
+    template <typename... Args>
+    static ControlBlockBatch* create(Slab* slab, size_t index,
+                                     const Args&... args) {
+        using allocTraits = typename std::allocator_traits<
+            Alloc>::template rebind_traits<T>;
+        using allocType = typename std::allocator_traits<
+            Alloc>::template rebind_alloc<T>;
+        auto* block = new (cell(slab, index)) ControlBlockBatch(slab);
+        allocType alloc_copy = slab->get();
+        allocTraits::construct(alloc_copy, &block->object, args...);
+        slab->cells.fetch_add(1, std::memory_order_relaxed);
+        notifyAllocate(block, &block->object, sizeof(ControlBlockBatch));
+        return block;
+    }
+
+    static void manage(BaseControlBlock<Policy>* base, ControlBlockOp op) {
+        auto* self = static_cast<ControlBlockBatch*>(base);
+        if (op != ControlBlockOp::deallocate) {
+            self->destroy();
+        }
+        if (op != ControlBlockOp::destroy) {
+            Slab* slab = self->slab;
+            self->~ControlBlockBatch();
+            releaseSlab(slab);
+        }
+    }
+
+    void destroy() {
+        using allocTraits = typename std::allocator_traits<
+            Alloc>::template rebind_traits<T>;
+        using allocType = typename std::allocator_traits<
+            Alloc>::template rebind_alloc<T>;
+        allocType alloc_copy = slab->get();
+        allocTraits::destroy(alloc_copy, &object);
+    }
+};
+
+static_assert(sizeof(ControlBlockRegular<int, std::default_delete<int>,
+                                         std::allocator<int>, AtomicPolicy>) ==
+                  sizeof(BaseControlBlock<AtomicPolicy>) + sizeof(int*),
+              "stateless deleter and allocator must not take space");
+static_assert(sizeof(ControlBlockErased<AtomicPolicy>) ==
+                  sizeof(BaseControlBlock<AtomicPolicy>) + sizeof(void*),
+              "erased deleters must not take space");
+static_assert(sizeof(ControlBlockMakeShared<void*, std::allocator<void*>,
+                                           AtomicPolicy>) ==
+                  sizeof(BaseControlBlock<AtomicPolicy>) + sizeof(void*),
+              "stateless allocator must not take space");
+static_assert(alignof(ControlBlockMakeShared<int, std::allocator<int>,
+                                            AtomicPolicy, true>) ==
+                  kCacheLineSize,
+              "padded objects must start on their own cache line");
+static_assert(sizeof(ControlBlockArray<int, std::allocator<int>,
+                                       AtomicPolicy>) ==
+                  sizeof(BaseControlBlock<AtomicPolicy>) + sizeof(size_t),
+              "stateless allocator must not take space");
+
+// Only types the pointer itself could destroy: a deleter or the block of a
+// derived object may be the only one allowed to run the destructor.
+template <typename T, typename = void>
+struct has_inline_control_block : std::false_type {};
+
 template <typename T>
+struct has_inline_control_block<T, std::void_t<decltype(sizeof(T))>>
+    : std::bool_constant<!std::is_abstract_v<T> && !std::is_array_v<T> &&
+                         std::is_destructible_v<T>> {};
+
+// Blocks made by makeShared<T>() are by far the most common, so they are
+// recognised by their manager and handled with a direct, inlinable call.
+template <typename T, typename Policy>
+void manageControlBlock(BaseControlBlock<Policy>* cb, ControlBlockOp op) {
+    if constexpr (observes_allocation<Policy>::value) {
+        if (op != ControlBlockOp::destroy) {
+            Policy::onDeallocate(cb);
+        }
+    }
+    if constexpr (has_inline_control_block<T>::value) {
+        using Object = std::remove_cv_t<T>;
+        using Inline =
+            ControlBlockMakeShared<Object, std::allocator<Object>, Policy>;
+        if (cb->manager == &Inline::manage) {
+            Inline::manage(cb, op);
+            return;
+        }
+    }
+    cb->manager(cb, op);
+}
+
+// Drops a weak reference, and frees the block with the last one.
+template <typename T, typename Policy>
+void releaseWeak(BaseControlBlock<Policy>* cb) noexcept {
+    if (!cb->immortal() && Policy::decrement(cb->weak_count) == 0) {
+        manageControlBlock<T>(cb, ControlBlockOp::deallocate);
+    }
+}
+
+// Policies with a static retire(cb) take over the release of blocks whose
+// shared count has dropped to zero, see DeferredPolicy.
+template <typename Policy, typename = void>
+struct defers_release : std::false_type {};
+
+template <typename Policy>
+struct defers_release<Policy,
+                      std::void_t<decltype(Policy::retire(
+                          std::declval<BaseControlBlock<Policy>*>()))>>
+    : std::true_type {};
+
+// Destroys the object while the weak reference of the shared owners pins
+// the block, then drops that reference.
+template <typename T, typename Policy>
+void destroyPinned(BaseControlBlock<Policy>* cb) {
+    manageControlBlock<T>(cb, ControlBlockOp::destroy);
+    if (Policy::decrement(cb->weak_count) == 0) {
+        manageControlBlock<T>(cb, ControlBlockOp::deallocate);
+    }
+}
+
+// Destroys the object of a block with no shared owners left, and frees
+// the block unless WeakPtrs still hold it. Deferring policies call this
+// when they reclaim a retired block.
+template <typename T, typename Policy>
+void reclaimControlBlock(BaseControlBlock<Policy>* cb) {
+    // Only the owners' own reference is left: no WeakPtr exists that could
+    // be copied, so nothing can race with freeing the block.
+    if (Policy::load(cb->weak_count) == 1) {
+        manageControlBlock<T>(cb, ControlBlockOp::release);
+        return;
+    }
+    // The object may hold the last weak references to itself; the owners'
+    // reference keeps the block alive until it is destroyed.
+    destroyPinned<T>(cb);
+}
+
+// Runs once the shared count of `cb` has dropped to zero.
+template <typename T, typename Policy>
+void releaseLastShared(BaseControlBlock<Policy>* cb) {
+    if constexpr (defers_release<Policy>::value) {
+        Policy::retire(cb);
+    } else {
+        reclaimControlBlock<T>(cb);
+    }
+}
+
+// Types deriving from IntrusiveRefCounted are their own control block, so
+// adopting a raw pointer (even several times) needs no extra allocation.
+// The object is deleted once both shared and weak references are gone.
+//
+// The owners' weak reference is only taken by the first adoption, so a
+// weak count of zero tells a fresh object from one that has expired while
+// WeakPtrs keep it; adopting the latter takes the reference again.
+template <typename Policy = AtomicPolicy>
+struct IntrusiveRefCounted : BaseControlBlock<Policy> {
+    IntrusiveRefCounted() : BaseControlBlock<Policy>(&manage, 0) {}
+
+    IntrusiveRefCounted(const IntrusiveRefCounted&) : IntrusiveRefCounted() {}
+
+    IntrusiveRefCounted& operator=(const IntrusiveRefCounted&) {
+        return *this;
+    }
+
+    virtual ~IntrusiveRefCounted() = default;
+
+    static void manage(BaseControlBlock<Policy>* base, ControlBlockOp op) {
+        if (op != ControlBlockOp::destroy) {
+            delete static_cast<IntrusiveRefCounted*>(base);
+        }
+    }
+};
+
+template <typename T, typename Policy = AtomicPolicy>
 class SharedPtr {
+  public:
+    using element_type = std::remove_extent_t<T>;
+
   private:
+    template <typename Alloc, bool Padded>
+    SharedPtr(ControlBlockMakeShared<T, Alloc, Policy, Padded>* cb)
+        : ptr(&cb->object), cb(cb) {
+        Policy::increment(cb->shared_count);
+        enableSharedFromThis(ptr);
+    }
+
     template <typename Alloc>
-    SharedPtr(ControlBlockMakeShared<T, Alloc>* cb) : ptr(nullptr), cb(cb) {
-        if (cb != nullptr) {
-            ++(cb->shared_count);
+    SharedPtr(ControlBlockArray<element_type, Alloc, Policy>* cb)
+        : ptr(cb->elements()), cb(cb) {
+        Policy::increment(cb->shared_count);
+    }
+
+    SharedPtr(ControlBlockImmortal<T, Policy>* cb)
+        : ptr(&cb->object), cb(cb) {
+        Policy::increment(cb->shared_count);
+        enableSharedFromThis(ptr);
+    }
+
+    template <typename Alloc>
+    SharedPtr(ControlBlockBatch<T, Alloc, Policy>* cb)
+        : ptr(&cb->object), cb(cb) {
+        Policy::increment(cb->shared_count);
+        enableSharedFromThis(ptr);
+    }
+
+    element_type* ptr = nullptr;
+    BaseControlBlock<Policy>* cb = nullptr;
+
+    template <typename U>
+    void enableSharedFromThis(U* object) {
+        if constexpr (!std::is_array_v<T> &&
+                      decltype(derivesFromEnableSharedFromThis<Policy>(
+                          object))::value) {
+            if (object != nullptr) {
+                assignWeakThis(object, object);
+            }
         }
     }
 
-    SharedPtr(const WeakPtr<T>& p) : ptr(p.ptr), cb(p.cb) {
-        if (cb != nullptr) {
-            ++(cb->shared_count);
+    template <typename V, typename U>
+    void assignWeakThis(const EnableSharedFromThis<V, Policy>* base,
+                        U* object) {
+        if (!base->weak_this.expired()) {
+            return;
         }
+        WeakPtr<V, Policy> self;
+        self.ptr = object;
+        self.cb = cb;
+        acquireWeak(cb);
+        base->weak_this.swap(self);
     }
 
-    T* ptr = nullptr;
-    BaseControlBlock* cb = nullptr;
+    // Drops one shared reference to `cb`; callers detach it from *this
+    // first, so destructors that reach back into this pointer see it
+    // already updated.
+    static void dropReference(BaseControlBlock<Policy>* cb) noexcept {
+        if (cb != nullptr && !cb->immortal() &&
+            Policy::decrement(cb->shared_count) == 0) {
+            releaseLastShared<T>(cb);
+        }
+    }
+
+    template <typename U>
+    void assign(const SharedPtr<U, Policy>& other) noexcept {
+        BaseControlBlock<Policy>* previous = cb;
+        if (other.cb != previous) {
+            if (other.cb != nullptr) {
+                acquireShared(other.cb);
+            }
+            cb = other.cb;
+            ptr = other.ptr;
+            dropReference(previous);
+            return;
+        }
+        ptr = other.ptr;
+    }
+
+    template <typename U>
+    void steal(SharedPtr<U, Policy>& other) noexcept {
+        BaseControlBlock<Policy>* previous = cb;
+        ptr = other.ptr;
+        cb = other.cb;
+        other.ptr = nullptr;
+        other.cb = nullptr;
+        dropReference(previous);
+    }
+
+    // A raw word is either the block address with the signed distance to
+    // the object in its top 16 bits, or, with the low bit set, a RawBox.
+    // Without spare bits above the address, as on 32-bit targets, every
+    // pointer is boxed.
+    static constexpr uintptr_t kBoxed = 1;
+    static constexpr int kAddressBits = sizeof(uintptr_t) >= 8 ? 48 : 0;
+
+    struct RawBox {
+        element_type* ptr;
+        BaseControlBlock<Policy>* cb;
+    };
+
+    static uintptr_t pack(element_type* ptr, BaseControlBlock<Policy>* cb) {
+        if (ptr == nullptr || cb == nullptr) {
+            return 0;
+        }
+        auto block = reinterpret_cast<uintptr_t>(cb);
+        auto offset =
+            static_cast<intptr_t>(reinterpret_cast<uintptr_t>(ptr) - block);
+        if ((block >> kAddressBits) != 0 || offset < INT16_MIN ||
+            offset > INT16_MAX) {
+            return 0;
+        }
+        return block | static_cast<uintptr_t>(static_cast<uint16_t>(offset))
+                           << kAddressBits;
+    }
 
   public:
+    // Gives up ownership as a single word, without touching the counts;
+    // adoptRaw() turns it back into a SharedPtr, exactly once. Pointers to
+    // an object next to its block, as made by makeShared() and
+    // makeSharedBatch() or to intrusive objects, fit in the word itself.
+    // Others, such as adopted or aliasing pointers, are boxed in a small
+    // heap node, so each of their hand-offs costs an allocation here and a
+    // deallocation in adoptRaw(). An empty pointer gives 0.
+    uintptr_t release() {
+        if (ptr == nullptr && cb == nullptr) {
+            return 0;
+        }
+        uintptr_t word = pack(ptr, cb);
+        if (word == 0) {
+            word = reinterpret_cast<uintptr_t>(new RawBox{ptr, cb}) | kBoxed;
+        }
+        ptr = nullptr;
+        cb = nullptr;
+        return word;
+    }
+
+    static SharedPtr adoptRaw(uintptr_t word) noexcept {
+        SharedPtr adopted;
+        if (word == 0) {
+            return adopted;
+        }
+        if ((word & kBoxed) != 0) {
+            auto* box = reinterpret_cast<RawBox*>(word & ~kBoxed);
+            adopted.ptr = box->ptr;
+            adopted.cb = box->cb;
+            delete box;
+            return adopted;
+        }
+        uintptr_t block = word & ((uintptr_t{1} << kAddressBits) - 1);
+        auto offset = static_cast<int16_t>(word >> kAddressBits);
+        adopted.cb = reinterpret_cast<BaseControlBlock<Policy>*>(block);
+        adopted.ptr = reinterpret_cast<element_type*>(
+            block + static_cast<uintptr_t>(static_cast<intptr_t>(offset)));
+        return adopted;
+    }
+
     template <typename U, typename = is_base_or_derived<T, U>>
-    void swap(SharedPtr<U>& other) {
+    void swap(SharedPtr<U, Policy>& other) noexcept {
         std::swap(ptr, other.ptr);
         std::swap(cb, other.cb);
     }
 
-    template <typename U, typename... Args>
-    friend SharedPtr<U> makeShared(Args&&... args);
+    template <typename U, typename P, bool Padded, typename Alloc,
+              typename... Args>
+    friend SharedPtr<U, P> allocateSharedObject(const Alloc& alloc,
+                                                Args&&... args);
 
-    template <typename U, typename Alloc, typename... Args>
-    friend SharedPtr<U> allocateShared(const Alloc& alloc, Args&&... args);
+    template <typename U, typename P, bool ValueInit, typename Alloc>
+    friend SharedPtr<U, P> allocateSharedArray(const Alloc& alloc,
+                                               size_t size);
 
-    template <typename U>
+    template <typename U, typename P, typename... Args>
+    friend SharedPtr<U, P> createImmortal(Args&&... args);
+
+    template <typename U, typename P, typename Alloc, typename... Args>
+    friend std::vector<SharedPtr<U, P>> allocateSharedSlab(
+        const Alloc& alloc, size_t size, const Args&... args);
+
+    template <typename U, typename P>
     friend class WeakPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
 
+    template <typename U>
+    friend class AtomicSharedPtr;
+
+    template <typename U, typename P>
+    friend class BorrowedPtr;
+
+    // Policies may reach the control block, e.g. to switch its mode.
+    friend Policy;
+
     SharedPtr(){};
 
-    template <typename U, typename Deleter = std::default_delete<T>,
-              typename Alloc = std::allocator<T>>
+    template <typename U, typename Deleter = default_deleter<T>,
+              typename Alloc = std::allocator<element_type>>
     SharedPtr(U* ptr, Deleter deleter = Deleter(), Alloc alloc = Alloc())
         : ptr(ptr) {
-        using ControlBlockAllocator =
-            typename std::allocator_traits<Alloc>::template rebind_alloc<
-                ControlBlockRegular<T, Deleter, Alloc>>;
-        using ControlBlockAllocatorTraits =
-            typename std::allocator_traits<Alloc>::template rebind_traits<
-                ControlBlockRegular<T, Deleter, Alloc>>;
+        if constexpr (std::is_base_of_v<IntrusiveRefCounted<Policy>, U>) {
+            static_assert(std::is_same_v<Deleter, default_deleter<T>> &&
+                              std::is_same_v<Alloc,
+                                             std::allocator<element_type>>,
+                          "intrusive objects release their own storage");
+            cb = ptr;
+            if (cb != nullptr) {
+                if (Policy::load(cb->shared_count) == 0) {
+                    if (Policy::load(cb->weak_count) == 0) {
+                        notifyAllocate(cb, ptr, sizeof(U));
+                    }
+                    Policy::increment(cb->weak_count);
+                }
+                Policy::increment(cb->shared_count);
+            }
+        } else if constexpr (erases_deleter<Deleter, Alloc>::value) {
+            using Block = ControlBlockErased<Policy>;
+            Block* pt = Block::create(
+                const_cast<void*>(static_cast<const volatile void*>(
+                    static_cast<element_type*>(ptr))),
+                &Block::template manage<element_type, Deleter>);
+            if constexpr (is_complete<U>::value) {
+                notifyAllocate(pt, ptr, sizeof(*pt) + sizeof(U));
+            } else {
+                notifyAllocate(pt, static_cast<const void*>(ptr),
+                               sizeof(*pt));
+            }
 
-        ControlBlockAllocator controlBlockAlloc = alloc;
-        auto pt = ControlBlockAllocatorTraits::allocate(controlBlockAlloc, 1);
-        new (pt) ControlBlockRegular<T, Deleter, Alloc>(ptr, deleter, alloc);
+            cb = pt;
+            Policy::increment(cb->shared_count);
+            enableSharedFromThis(ptr);
+        } else {
+            using ControlBlockAllocator =
+                typename std::allocator_traits<Alloc>::template rebind_alloc<
+                    ControlBlockRegular<element_type, Deleter, Alloc, Policy>>;
+            using ControlBlockAllocatorTraits =
+                typename std::allocator_traits<Alloc>::template rebind_traits<
+                    ControlBlockRegular<element_type, Deleter, Alloc, Policy>>;
+
+            ControlBlockAllocator controlBlockAlloc = alloc;
+            auto pt =
+                ControlBlockAllocatorTraits::allocate(controlBlockAlloc, 1);
+            new (pt) ControlBlockRegular<element_type, Deleter, Alloc,
+                                         Policy>(ptr, deleter, alloc);
+            if constexpr (is_complete<U>::value) {
+                notifyAllocate(pt, ptr, sizeof(*pt) + sizeof(U));
+            } else {
+                notifyAllocate(pt, static_cast<const void*>(ptr),
+                               sizeof(*pt));
+            }
 
-        cb = pt;
-        ++(cb->shared_count);
+            cb = pt;
+            acquireShared(cb);
+            enableSharedFromThis(ptr);
+        }
     }
 
     SharedPtr(const SharedPtr& other) : ptr(other.ptr), cb(other.cb) {
         if (other.cb != nullptr) {
-            ++(cb->shared_count);
+            acquireShared(cb);
         }
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    SharedPtr(const SharedPtr<U>& other) : ptr(other.ptr), cb(other.cb) {
+    SharedPtr(const SharedPtr<U, Policy>& other)
+        : ptr(other.ptr), cb(other.cb) {
         if (other.cb != nullptr) {
-            ++(cb->shared_count);
+            acquireShared(cb);
+        }
+    }
+
+    template <typename U>
+    SharedPtr(const SharedPtr<U, Policy>& other, element_type* ptr)
+        : ptr(ptr), cb(other.cb) {
+        if (cb != nullptr) {
+            acquireShared(cb);
         }
     }
 
-    SharedPtr(SharedPtr&& other) : ptr(other.ptr), cb(other.cb) {
+    template <typename U>
+    SharedPtr(SharedPtr<U, Policy>&& other, element_type* ptr) noexcept
+        : ptr(ptr), cb(other.cb) {
+        other.ptr = nullptr;
+        other.cb = nullptr;
+    }
+
+    SharedPtr(SharedPtr&& other) noexcept : ptr(other.ptr), cb(other.cb) {
         other.ptr = nullptr;
         other.cb = nullptr;
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    SharedPtr(SharedPtr<U>&& other) : ptr(other.ptr), cb(other.cb) {
+    SharedPtr(SharedPtr<U, Policy>&& other) noexcept
+        : ptr(other.ptr), cb(other.cb) {
         other.ptr = nullptr;
         other.cb = nullptr;
     }
 
-    SharedPtr& operator=(const SharedPtr& other) {
-        if (this == &other) {
-            return *this;
-        }
-        SharedPtr<T> copy = SharedPtr(other);
-        swap(copy);
+    SharedPtr& operator=(const SharedPtr& other) noexcept {
+        assign(other);
         return *this;
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    SharedPtr& operator=(const SharedPtr<U>& other) {
-        SharedPtr<T> copy(other);
-        swap(copy);
+    SharedPtr& operator=(const SharedPtr<U, Policy>& other) noexcept {
+        assign(other);
         return *this;
     }
 
-    SharedPtr& operator=(SharedPtr&& other) {
-        SharedPtr copy(std::move(other));
-        swap(copy);
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
+        if (this != &other) {
+            steal(other);
+        }
         return *this;
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    SharedPtr& operator=(SharedPtr<U>&& other) {
-        SharedPtr<T> copy(std::move(other));
-        swap(copy);
+    SharedPtr& operator=(SharedPtr<U, Policy>&& other) noexcept {
+        steal(other);
         return *this;
     }
 
@@ -192,131 +1091,180 @@ class SharedPtr {
         if (cb == nullptr) {
             return 0;
         }
-        return cb->shared_count;
+        return Policy::load(cb->shared_count);
     }
 
-    void reset() {
-        SharedPtr<T>().swap(*this);
+    void reset() noexcept {
+        BaseControlBlock<Policy>* previous = cb;
+        ptr = nullptr;
+        cb = nullptr;
+        dropReference(previous);
     }
 
-    template <typename U, typename Deleter = std::default_delete<T>,
-              typename Alloc = std::allocator<T>>
+    template <typename U, typename Deleter = default_deleter<T>,
+              typename Alloc = std::allocator<element_type>>
     void reset(U* ptr, Deleter del = Deleter(), Alloc alloc = Alloc()) {
-        SharedPtr<T>(ptr, del, alloc).swap(*this);
+        SharedPtr<T, Policy>(ptr, del, alloc).swap(*this);
     }
 
-    T& operator*() const {
-        if (ptr != nullptr) {
-            return *ptr;
-        }
-        return static_cast<ControlBlockMakeShared<T>*>(cb)->ptr;
+    element_type& operator*() const {
+        return *ptr;
     }
 
-    T* operator->() const {
-        if (ptr != nullptr) {
-            return ptr;
-        }
-        return &(static_cast<ControlBlockMakeShared<T>*>(cb)->ptr);
+    element_type* operator->() const {
+        return ptr;
+    }
+
+    element_type& operator[](ptrdiff_t index) const {
+        return ptr[index];
     }
 
-    T* get() const {
+    element_type* get() const {
         return ptr;
     }
 
+    // Ordering, hashing and equality by control block rather than by the
+    // stored pointer, as keys that stay put when the object expires and
+    // that treat aliasing pointers into one object as the same owner.
+    template <typename U>
+    bool ownerBefore(const SharedPtr<U, Policy>& other) const noexcept {
+        return std::less<BaseControlBlock<Policy>*>()(cb, other.cb);
+    }
+
+    template <typename U>
+    bool ownerBefore(const WeakPtr<U, Policy>& other) const noexcept {
+        return std::less<BaseControlBlock<Policy>*>()(cb, other.cb);
+    }
+
+    template <typename U>
+    bool ownerEquals(const SharedPtr<U, Policy>& other) const noexcept {
+        return cb == other.cb;
+    }
+
+    template <typename U>
+    bool ownerEquals(const WeakPtr<U, Policy>& other) const noexcept {
+        return cb == other.cb;
+    }
+
+    size_t ownerHash() const noexcept {
+        return std::hash<BaseControlBlock<Policy>*>()(cb);
+    }
+
     ~SharedPtr() {
-        if (cb == nullptr) {
-            return;
-        }
-        --(cb->shared_count);
-        if (cb->shared_count == 0) {
-            cb->destroy();
-            if (cb->weak_count == 0) {
-                cb->deallocate();
-            }
-        }
+        dropReference(cb);
     }
 };
 
-template <typename T>
+template <typename T, typename Policy>
 class WeakPtr {
   private:
-    T* ptr = nullptr;
-    BaseControlBlock* cb = nullptr;
+    std::remove_extent_t<T>* ptr = nullptr;
+    BaseControlBlock<Policy>* cb = nullptr;
+
+    static void dropReference(BaseControlBlock<Policy>* cb) noexcept {
+        if (cb != nullptr) {
+            releaseWeak<T>(cb);
+        }
+    }
+
+    template <typename U>
+    void assign(const WeakPtr<U, Policy>& other) noexcept {
+        BaseControlBlock<Policy>* previous = cb;
+        ptr = other.ptr;
+        if (other.cb != previous) {
+            if (other.cb != nullptr) {
+                acquireWeak(other.cb);
+            }
+            cb = other.cb;
+            dropReference(previous);
+        }
+    }
+
+    template <typename U>
+    void steal(WeakPtr<U, Policy>& other) noexcept {
+        BaseControlBlock<Policy>* previous = cb;
+        ptr = other.ptr;
+        cb = other.cb;
+        other.ptr = nullptr;
+        other.cb = nullptr;
+        dropReference(previous);
+    }
 
   public:
-    void swap(WeakPtr<T>& other) {
+    void swap(WeakPtr<T, Policy>& other) noexcept {
         std::swap(ptr, other.ptr);
         std::swap(cb, other.cb);
     }
 
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
 
     WeakPtr(){};
 
-    WeakPtr(const SharedPtr<T>& shared) : ptr(shared.ptr), cb(shared.cb) {
+    WeakPtr(const SharedPtr<T, Policy>& shared)
+        : ptr(shared.ptr), cb(shared.cb) {
         if (cb != nullptr) {
-            ++cb->weak_count;
+            acquireWeak(cb);
         }
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    WeakPtr(const SharedPtr<U>& shared) : ptr(shared.ptr), cb(shared.cb) {
+    WeakPtr(const SharedPtr<U, Policy>& shared)
+        : ptr(shared.ptr), cb(shared.cb) {
         if (cb != nullptr) {
-            ++cb->weak_count;
+            acquireWeak(cb);
         }
     }
 
     WeakPtr(const WeakPtr& other) : ptr(other.ptr), cb(other.cb) {
         if (cb != nullptr) {
-            ++cb->weak_count;
+            acquireWeak(cb);
         }
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    WeakPtr(const WeakPtr<U>& other) : ptr(other.ptr), cb(other.cb) {
+    WeakPtr(const WeakPtr<U, Policy>& other) : ptr(other.ptr), cb(other.cb) {
         if (cb != nullptr) {
-            ++cb->weak_count;
+            acquireWeak(cb);
         }
     }
 
-    WeakPtr(WeakPtr&& other) : ptr(other.ptr), cb(other.cb) {
+    WeakPtr(WeakPtr&& other) noexcept : ptr(other.ptr), cb(other.cb) {
         other.ptr = nullptr;
         other.cb = nullptr;
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    WeakPtr(WeakPtr<U>&& other) : ptr(other.ptr), cb(other.cb) {
+    WeakPtr(WeakPtr<U, Policy>&& other) noexcept
+        : ptr(other.ptr), cb(other.cb) {
         other.ptr = nullptr;
         other.cb = nullptr;
     }
 
-    WeakPtr& operator=(const WeakPtr& other) {
-        WeakPtr<T> copy(other);
-        swap(copy);
+    WeakPtr& operator=(const WeakPtr& other) noexcept {
+        assign(other);
         return *this;
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    WeakPtr& operator=(const WeakPtr<U>& other) {
-        WeakPtr<T> copy(other);
-        swap(copy);
+    WeakPtr& operator=(const WeakPtr<U, Policy>& other) noexcept {
+        assign(other);
         return *this;
     }
 
-    WeakPtr& operator=(WeakPtr&& other) {
-        WeakPtr<T> copy(std::move(other));
-        swap(copy);
+    WeakPtr& operator=(WeakPtr&& other) noexcept {
+        if (this != &other) {
+            steal(other);
+        }
         return *this;
     }
 
     template <typename U, typename = is_base_or_derived<T, U>>
-    WeakPtr& operator=(WeakPtr<U>&& other) {
-        WeakPtr<T> copy(std::move(other));
-        swap(copy);
+    WeakPtr& operator=(WeakPtr<U, Policy>&& other) noexcept {
+        steal(other);
         return *this;
     }
 
@@ -324,45 +1272,518 @@ class WeakPtr {
         if (cb == nullptr) {
             return 0;
         }
-        return cb->shared_count;
+        return Policy::load(cb->shared_count);
     }
 
     bool expired() const {
         return use_count() == 0;
     }
 
-    SharedPtr<T> lock() const {
-        if (expired()) {
-            return SharedPtr<T>();
+    SharedPtr<T, Policy> lock() const {
+        SharedPtr<T, Policy> locked;
+        if (cb != nullptr && (cb->immortal() || Policy::incrementIfNonZero(
+                                                   cb->shared_count))) {
+            locked.ptr = ptr;
+            locked.cb = cb;
         }
-        return SharedPtr<T>(*this);
+        return locked;
+    }
+
+    // Raw access for the lifetime of the returned guard without touching the
+    // shared count; needs a policy that defers reclamation, see EpochPolicy.
+    ProtectedPtr<T, Policy> protect() const {
+        return ProtectedPtr<T, Policy>(ptr, cb);
+    }
+
+    // See SharedPtr::ownerBefore().
+    template <typename U>
+    bool ownerBefore(const WeakPtr<U, Policy>& other) const noexcept {
+        return std::less<BaseControlBlock<Policy>*>()(cb, other.cb);
+    }
+
+    template <typename U>
+    bool ownerBefore(const SharedPtr<U, Policy>& other) const noexcept {
+        return std::less<BaseControlBlock<Policy>*>()(cb, other.cb);
+    }
+
+    template <typename U>
+    bool ownerEquals(const WeakPtr<U, Policy>& other) const noexcept {
+        return cb == other.cb;
+    }
+
+    template <typename U>
+    bool ownerEquals(const SharedPtr<U, Policy>& other) const noexcept {
+        return cb == other.cb;
+    }
+
+    size_t ownerHash() const noexcept {
+        return std::hash<BaseControlBlock<Policy>*>()(cb);
     }
 
     ~WeakPtr() {
-        if (cb == nullptr) {
-            return;
+        dropReference(cb);
+    }
+};
+
+// Non-owning view of a SharedPtr for passing across calls without touching
+// the counts. The source must outlive the borrow; debug builds check that
+// the object is still owned on every access, and hold a weak reference so
+// that the block can still be read once it is not.
+template <typename T, typename Policy>
+class BorrowedPtr {
+  public:
+    using element_type = std::remove_extent_t<T>;
+
+  private:
+    element_type* ptr = nullptr;
+    BaseControlBlock<Policy>* cb = nullptr;
+
+    void checkAlive() const {
+        assert(cb == nullptr || Policy::load(cb->shared_count) != 0);
+    }
+
+    void retainBlock() {
+#ifndef NDEBUG
+        if (cb != nullptr) {
+            acquireWeak(cb);
         }
-        --(cb->weak_count);
-        if (cb->weak_count == 0 && cb->shared_count == 0) {
-            cb->deallocate();
+#endif
+    }
+
+    void releaseBlock() {
+#ifndef NDEBUG
+        if (cb != nullptr) {
+            releaseWeak<T>(cb);
         }
+#endif
+    }
+
+  public:
+    BorrowedPtr() {}
+
+    template <typename U, typename = is_base_or_derived<T, U>>
+    BorrowedPtr(const SharedPtr<U, Policy>& shared)
+        : ptr(shared.ptr), cb(shared.cb) {
+        retainBlock();
+    }
+
+    template <typename U, typename = is_base_or_derived<T, U>>
+    BorrowedPtr(SharedPtr<U, Policy>&&) = delete;
+
+    BorrowedPtr(const BorrowedPtr& other) : ptr(other.ptr), cb(other.cb) {
+        retainBlock();
+    }
+
+    template <typename U, typename = is_base_or_derived<T, U>>
+    BorrowedPtr(const BorrowedPtr<U, Policy>& other)
+        : ptr(other.ptr), cb(other.cb) {
+        retainBlock();
+    }
+
+    BorrowedPtr& operator=(const BorrowedPtr& other) {
+        BorrowedPtr copy(other);
+        std::swap(ptr, copy.ptr);
+        std::swap(cb, copy.cb);
+        return *this;
+    }
+
+    ~BorrowedPtr() {
+        releaseBlock();
+    }
+
+    template <typename U, typename P>
+    friend class BorrowedPtr;
+
+    SharedPtr<T, Policy> promote() const {
+        checkAlive();
+        SharedPtr<T, Policy> owned;
+        if (cb != nullptr) {
+            acquireShared(cb);
+            owned.ptr = ptr;
+            owned.cb = cb;
+        }
+        return owned;
+    }
+
+    element_type& operator*() const {
+        checkAlive();
+        return *ptr;
+    }
+
+    element_type* operator->() const {
+        checkAlive();
+        return ptr;
+    }
+
+    element_type& operator[](ptrdiff_t index) const {
+        checkAlive();
+        return ptr[index];
+    }
+
+    element_type* get() const {
+        checkAlive();
+        return ptr;
+    }
+};
+
+// Objects owned by a SharedPtr can derive from EnableSharedFromThis to
+// obtain further owners of themselves; the weak self-reference is filled in
+// when the first SharedPtr takes ownership.
+template <typename T, typename Policy>
+class EnableSharedFromThis {
+  private:
+    mutable WeakPtr<T, Policy> weak_this;
+
+    template <typename U, typename P>
+    friend class SharedPtr;
+
+  protected:
+    EnableSharedFromThis() {}
+
+    EnableSharedFromThis(const EnableSharedFromThis&) {}
+
+    EnableSharedFromThis& operator=(const EnableSharedFromThis&) {
+        return *this;
+    }
+
+    ~EnableSharedFromThis() = default;
+
+  public:
+    SharedPtr<T, Policy> sharedFromThis() {
+        return weak_this.lock();
+    }
+
+    SharedPtr<const T, Policy> sharedFromThis() const {
+        SharedPtr<T, Policy> self = weak_this.lock();
+        const T* object = self.get();
+        return SharedPtr<const T, Policy>(std::move(self), object);
+    }
+
+    WeakPtr<T, Policy> weakFromThis() {
+        return weak_this;
+    }
+
+    WeakPtr<const T, Policy> weakFromThis() const {
+        return WeakPtr<const T, Policy>(weak_this);
+    }
+};
+
+template <typename T, typename U, typename Policy>
+bool operator==(const SharedPtr<T, Policy>& lhs,
+                const SharedPtr<U, Policy>& rhs) {
+    return lhs.get() == rhs.get();
+}
+
+template <typename T, typename U, typename Policy>
+bool operator!=(const SharedPtr<T, Policy>& lhs,
+                const SharedPtr<U, Policy>& rhs) {
+    return lhs.get() != rhs.get();
+}
+
+template <typename T, typename U, typename Policy>
+bool operator<(const SharedPtr<T, Policy>& lhs,
+               const SharedPtr<U, Policy>& rhs) {
+    using Common =
+        std::common_type_t<typename SharedPtr<T, Policy>::element_type*,
+                           typename SharedPtr<U, Policy>::element_type*>;
+    return std::less<Common>()(lhs.get(), rhs.get());
+}
+
+template <typename T, typename U, typename Policy>
+bool operator>(const SharedPtr<T, Policy>& lhs,
+               const SharedPtr<U, Policy>& rhs) {
+    return rhs < lhs;
+}
+
+template <typename T, typename U, typename Policy>
+bool operator<=(const SharedPtr<T, Policy>& lhs,
+                const SharedPtr<U, Policy>& rhs) {
+    return !(rhs < lhs);
+}
+
+template <typename T, typename U, typename Policy>
+bool operator>=(const SharedPtr<T, Policy>& lhs,
+                const SharedPtr<U, Policy>& rhs) {
+    return !(lhs < rhs);
+}
+
+template <typename T, typename Policy>
+bool operator==(const SharedPtr<T, Policy>& lhs, std::nullptr_t) {
+    return lhs.get() == nullptr;
+}
+
+template <typename T, typename Policy>
+bool operator==(std::nullptr_t, const SharedPtr<T, Policy>& rhs) {
+    return rhs.get() == nullptr;
+}
+
+template <typename T, typename Policy>
+bool operator!=(const SharedPtr<T, Policy>& lhs, std::nullptr_t) {
+    return lhs.get() != nullptr;
+}
+
+template <typename T, typename Policy>
+bool operator!=(std::nullptr_t, const SharedPtr<T, Policy>& rhs) {
+    return rhs.get() != nullptr;
+}
+
+// Function objects for containers keyed on the owner, which mix SharedPtr
+// and WeakPtr freely: std::set<WeakPtr<T>, OwnerLess> or
+// std::unordered_map<WeakPtr<T>, V, OwnerHash, OwnerEqual>.
+struct OwnerLess {
+    using is_transparent = void;
+
+    template <typename L, typename R>
+    bool operator()(const L& lhs, const R& rhs) const noexcept {
+        return lhs.ownerBefore(rhs);
+    }
+};
+
+struct OwnerEqual {
+    using is_transparent = void;
+
+    template <typename L, typename R>
+    bool operator()(const L& lhs, const R& rhs) const noexcept {
+        return lhs.ownerEquals(rhs);
     }
 };
 
-template <typename U, typename Alloc, typename... Args>
-SharedPtr<U> allocateShared(const Alloc& alloc, Args&&... args) {
-    using SharedAlloc = typename std::template allocator_traits<
-        Alloc>::template rebind_alloc<ControlBlockMakeShared<U, Alloc>>;
+struct OwnerHash {
+    template <typename P>
+    size_t operator()(const P& pointer) const noexcept {
+        return pointer.ownerHash();
+    }
+};
+
+namespace std {
+
+// Hashes the stored pointer, consistent with operator==.
+template <typename T, typename Policy>
+struct hash<SharedPtr<T, Policy>> {
+    size_t operator()(const SharedPtr<T, Policy>& pointer) const noexcept {
+        return hash<typename SharedPtr<T, Policy>::element_type*>()(
+            pointer.get());
+    }
+};
+
+// A WeakPtr has no usable stored pointer once expired, so it hashes its
+// owner; compare with OwnerEqual.
+template <typename T, typename Policy>
+struct hash<WeakPtr<T, Policy>> {
+    size_t operator()(const WeakPtr<T, Policy>& pointer) const noexcept {
+        return pointer.ownerHash();
+    }
+};
+
+}  // namespace std
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> staticPointerCast(const SharedPtr<U, Policy>& other) {
+    return SharedPtr<T, Policy>(other, static_cast<T*>(other.get()));
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> staticPointerCast(SharedPtr<U, Policy>&& other) {
+    T* ptr = static_cast<T*>(other.get());
+    return SharedPtr<T, Policy>(std::move(other), ptr);
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> dynamicPointerCast(const SharedPtr<U, Policy>& other) {
+    if (T* ptr = dynamic_cast<T*>(other.get())) {
+        return SharedPtr<T, Policy>(other, ptr);
+    }
+    return SharedPtr<T, Policy>();
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> dynamicPointerCast(SharedPtr<U, Policy>&& other) {
+    if (T* ptr = dynamic_cast<T*>(other.get())) {
+        return SharedPtr<T, Policy>(std::move(other), ptr);
+    }
+    return SharedPtr<T, Policy>();
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> constPointerCast(const SharedPtr<U, Policy>& other) {
+    return SharedPtr<T, Policy>(other, const_cast<T*>(other.get()));
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> constPointerCast(SharedPtr<U, Policy>&& other) {
+    T* ptr = const_cast<T*>(other.get());
+    return SharedPtr<T, Policy>(std::move(other), ptr);
+}
+
+template <typename U, typename Policy, bool Padded, typename Alloc,
+          typename... Args>
+SharedPtr<U, Policy> allocateSharedObject(const Alloc& alloc,
+                                          Args&&... args) {
+    using SharedAlloc = typename std::template allocator_traits<Alloc>::
+        template rebind_alloc<ControlBlockMakeShared<U, Alloc, Policy, Padded>>;
     using SharedAllocTraits =
         typename std::template allocator_traits<SharedAlloc>;
     SharedAlloc sharedAlloc = alloc;
     auto* pt = SharedAllocTraits::allocate(sharedAlloc, 1);
-    SharedAllocTraits::construct(sharedAlloc, pt, std::move(alloc),
-                                 std::forward<Args>(args)...);
-    return SharedPtr<U>(pt);
+    try {
+        SharedAllocTraits::construct(sharedAlloc, pt, std::move(alloc),
+                                     std::forward<Args>(args)...);
+    } catch (...) {
+        SharedAllocTraits::deallocate(sharedAlloc, pt, 1);
+        throw;
+    }
+    return SharedPtr<U, Policy>(pt);
+}
+
+template <typename U, typename Policy = AtomicPolicy, typename Alloc,
+          typename... Args>
+std::enable_if_t<!std::is_array_v<U>, SharedPtr<U, Policy>> allocateShared(
+    const Alloc& alloc, Args&&... args) {
+    return allocateSharedObject<U, Policy, false>(alloc,
+                                                  std::forward<Args>(args)...);
+}
+
+template <typename U, typename Policy = AtomicPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<U>, SharedPtr<U, Policy>> makeShared(
+    Args&&... args) {
+    return allocateShared<U, Policy>(std::allocator<U>(),
+                                     std::forward<Args>(args)...);
+}
+
+// Like allocateShared/makeShared, but the counts and the object sit on
+// separate cache lines, for objects written on one thread while others copy
+// and drop references to them. Costs up to a cache line per object.
+template <typename U, typename Policy = AtomicPolicy, typename Alloc,
+          typename... Args>
+std::enable_if_t<!std::is_array_v<U>, SharedPtr<U, Policy>>
+allocateSharedPadded(const Alloc& alloc, Args&&... args) {
+    return allocateSharedObject<U, Policy, true>(alloc,
+                                                 std::forward<Args>(args)...);
+}
+
+template <typename U, typename Policy = AtomicPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<U>, SharedPtr<U, Policy>> makeSharedPadded(
+    Args&&... args) {
+    return allocateSharedPadded<U, Policy>(std::allocator<U>(),
+                                           std::forward<Args>(args)...);
+}
+
+template <typename U, typename Policy, typename... Args>
+SharedPtr<U, Policy> createImmortal(Args&&... args) {
+    return SharedPtr<U, Policy>(
+        new ControlBlockImmortal<U, Policy>(std::forward<Args>(args)...));
+}
+
+// An object that lives until the process exits. Copying and dropping its
+// pointers never writes to the control block, so any number of threads
+// can share it without contending on the counts.
+template <typename U, typename Policy = AtomicPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<U>, SharedPtr<U, Policy>> makeImmortal(
+    Args&&... args) {
+    return createImmortal<U, Policy>(std::forward<Args>(args)...);
+}
+
+template <typename U, typename Policy, typename Alloc, typename... Args>
+std::vector<SharedPtr<U, Policy>> allocateSharedSlab(const Alloc& alloc,
+                                                     size_t size,
+                                                     const Args&... args) {
+    using Block = ControlBlockBatch<U, Alloc, Policy>;
+    std::vector<SharedPtr<U, Policy>> batch;
+    if (size == 0) {
+        return batch;
+    }
+    batch.reserve(size);
+    typename Block::Slab* slab = Block::allocateSlab(alloc, size);
+    try {
+        for (size_t i = 0; i < size; ++i) {
+            batch.push_back(
+                SharedPtr<U, Policy>(Block::create(slab, i, args...)));
+        }
+    } catch (...) {
+        batch.clear();
+        Block::releaseSlab(slab);
+        throw;
+    }
+    Block::releaseSlab(slab);
+    return batch;
+}
+
+// `size` objects, each constructed from copies of `args`, in one
+// allocation with their control blocks: cheaper to create than as many
+// makeShared() calls, and contiguous for walking the batch. The objects
+// are released independently; the memory goes back to the allocator once
+// every one of them has no shared or weak references left.
+template <typename U, typename Policy = AtomicPolicy, typename Alloc,
+          typename... Args>
+std::enable_if_t<!std::is_array_v<U>, std::vector<SharedPtr<U, Policy>>>
+allocateSharedBatch(const Alloc& alloc, size_t size, const Args&... args) {
+    return allocateSharedSlab<U, Policy>(alloc, size, args...);
+}
+
+template <typename U, typename Policy = AtomicPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<U>, std::vector<SharedPtr<U, Policy>>>
+makeSharedBatch(size_t size, const Args&... args) {
+    return allocateSharedBatch<U, Policy>(std::allocator<U>(), size,
+                                          args...);
+}
+
+template <typename U, typename Policy, bool ValueInit, typename Alloc>
+SharedPtr<U, Policy> allocateSharedArray(const Alloc& alloc, size_t size) {
+    using Element = std::remove_extent_t<U>;
+    using Block = ControlBlockArray<Element, Alloc, Policy>;
+    return SharedPtr<U, Policy>(Block::template create<ValueInit>(alloc, size));
+}
+
+template <typename U, typename Policy = AtomicPolicy, typename Alloc>
+std::enable_if_t<is_array_of_unknown_bound<U>, SharedPtr<U, Policy>>
+allocateShared(const Alloc& alloc, size_t size) {
+    return allocateSharedArray<U, Policy, true>(alloc, size);
+}
+
+template <typename U, typename Policy = AtomicPolicy, typename Alloc>
+std::enable_if_t<is_array_of_known_bound<U>, SharedPtr<U, Policy>>
+allocateShared(const Alloc& alloc) {
+    return allocateSharedArray<U, Policy, true>(alloc, std::extent_v<U>);
+}
+
+template <typename U, typename Policy = AtomicPolicy>
+std::enable_if_t<is_array_of_unknown_bound<U>, SharedPtr<U, Policy>>
+makeShared(size_t size) {
+    return allocateShared<U, Policy>(std::allocator<std::remove_extent_t<U>>(),
+                                     size);
+}
+
+template <typename U, typename Policy = AtomicPolicy>
+std::enable_if_t<is_array_of_known_bound<U>, SharedPtr<U, Policy>>
+makeShared() {
+    return allocateShared<U, Policy>(
+        std::allocator<std::remove_extent_t<U>>());
+}
+
+// The ForOverwrite variants default-initialise the elements, leaving
+// trivial element types such as sample buffers uninitialised.
+template <typename U, typename Policy = AtomicPolicy, typename Alloc>
+std::enable_if_t<is_array_of_unknown_bound<U>, SharedPtr<U, Policy>>
+allocateSharedForOverwrite(const Alloc& alloc, size_t size) {
+    return allocateSharedArray<U, Policy, false>(alloc, size);
+}
+
+template <typename U, typename Policy = AtomicPolicy, typename Alloc>
+std::enable_if_t<is_array_of_known_bound<U>, SharedPtr<U, Policy>>
+allocateSharedForOverwrite(const Alloc& alloc) {
+    return allocateSharedArray<U, Policy, false>(alloc, std::extent_v<U>);
+}
+
+template <typename U, typename Policy = AtomicPolicy>
+std::enable_if_t<is_array_of_unknown_bound<U>, SharedPtr<U, Policy>>
+makeSharedForOverwrite(size_t size) {
+    return allocateSharedForOverwrite<U, Policy>(
+        std::allocator<std::remove_extent_t<U>>(), size);
 }
 
-template <typename U, typename... Args>
-SharedPtr<U> makeShared(Args&&... args) {
-    return allocateShared<U>(std::allocator<U>(), std::forward<Args>(args)...);
+template <typename U, typename Policy = AtomicPolicy>
+std::enable_if_t<is_array_of_known_bound<U>, SharedPtr<U, Policy>>
+makeSharedForOverwrite() {
+    return allocateSharedForOverwrite<U, Policy>(
+        std::allocator<std::remove_extent_t<U>>());
 }
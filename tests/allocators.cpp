@@ -0,0 +1,115 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <thread>
+
+#include "arena_allocator.h"
+#include "check.h"
+#include "pool_allocator.h"
+#include "smart_pointers.h"
+
+namespace {
+
+// Tracks the bytes it hands out that have not come back yet.
+class CountingResource : public std::pmr::memory_resource {
+  public:
+    size_t outstanding = 0;
+
+  private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        outstanding += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* pointer, size_t bytes,
+                       size_t alignment) override {
+        outstanding -= bytes;
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes,
+                                                    alignment);
+    }
+
+    bool do_is_equal(
+        const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+bool within(const void* pointer, const unsigned char* buffer, size_t size) {
+    auto address = reinterpret_cast<uintptr_t>(pointer);
+    auto first = reinterpret_cast<uintptr_t>(buffer);
+    return address >= first && address < first + size;
+}
+
+}  // namespace
+
+// A freed block is the next one handed out on the same thread.
+TEST(PoolAllocatorReusesBlocks) {
+    PoolAllocator<Counted> pool;
+    auto first = allocateShared<Counted>(pool, 7);
+    CHECK(first->value == 7);
+    const Counted* object = first.get();
+    first.reset();
+    CHECK(Counted::live == 0);
+    auto second = allocateShared<Counted>(pool, 8);
+    CHECK(second.get() == object);
+
+    SharedPtr<Counted> adopted(new Counted(9), std::default_delete<Counted>(),
+                               pool);
+    CHECK(adopted->value == 9);
+
+    // Freed on another thread, whose cache hands it back when it exits.
+    std::thread([moved = std::move(second)]() mutable { moved.reset(); })
+        .join();
+    adopted.reset();
+    CHECK(Counted::live == 0);
+}
+
+TEST(PoolAllocatorLargeRequests) {
+    PoolAllocator<unsigned char> pool;
+    constexpr size_t kSize = ControlBlockPool::kMaxSize * 4;
+    unsigned char* bytes = pool.allocate(kSize);
+    bytes[0] = 1;
+    bytes[kSize - 1] = 1;
+    pool.deallocate(bytes, kSize);
+
+    auto array = allocateShared<Counted[]>(PoolAllocator<Counted>(), 100);
+    CHECK(Counted::live == 100);
+    array.reset();
+    CHECK(Counted::live == 0);
+}
+
+TEST(ArenaBlocks) {
+    alignas(std::max_align_t) unsigned char buffer[4096];
+    {
+        std::pmr::monotonic_buffer_resource arena(
+            buffer, sizeof(buffer), std::pmr::null_memory_resource());
+        auto shared = makeSharedInArena<Counted>(&arena, 7);
+        CHECK(shared->value == 7);
+        CHECK(within(shared.get(), buffer, sizeof(buffer)));
+        WeakPtr<Counted> weak(shared);
+        shared.reset();
+        CHECK(Counted::live == 0);
+        CHECK(weak.expired());
+
+        auto batch = allocateSharedBatch<Counted>(
+            ArenaAllocator<Counted>(&arena), 3, 8);
+        CHECK(Counted::live == 3);
+        CHECK(within(batch[2].get(), buffer, sizeof(buffer)));
+        batch.clear();
+        CHECK(Counted::live == 0);
+    }
+}
+
+TEST(PmrBlocks) {
+    CountingResource resource;
+    auto shared = makeSharedIn<Counted>(&resource, 7);
+    CHECK(shared->value == 7);
+    CHECK(resource.outstanding != 0);
+    SharedPtr<Counted> adopted(
+        new Counted(8), std::default_delete<Counted>(),
+        std::pmr::polymorphic_allocator<Counted>(&resource));
+    shared.reset();
+    adopted.reset();
+    CHECK(Counted::live == 0);
+    CHECK(resource.outstanding == 0);
+}
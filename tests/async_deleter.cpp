@@ -0,0 +1,51 @@
+#include <stdexcept>
+#include <thread>
+
+#include "async_deleter.h"
+#include "check.h"
+
+namespace {
+
+struct RecordingDelete {
+    std::thread::id* deleted_on;
+
+    void operator()(Counted* object) const {
+        *deleted_on = std::this_thread::get_id();
+        delete object;
+    }
+};
+
+struct RefusingExecutor {
+    template <typename Task>
+    void execute(Task&&) {
+        throw std::runtime_error("refused");
+    }
+};
+
+}  // namespace
+
+// The block goes at once; the object is deleted on the executor's thread.
+TEST(AsyncDeleterRunsOnExecutor) {
+    DeletionThread executor;
+    std::thread::id deleted_on;
+    SharedPtr<Counted> shared(
+        new Counted(7),
+        deleteOn<Counted>(executor, RecordingDelete{&deleted_on}));
+    WeakPtr<Counted> weak(shared);
+    shared.reset();
+    CHECK(weak.expired());
+    executor.drain();
+    CHECK(Counted::live == 0);
+    CHECK(deleted_on != std::thread::id());
+    CHECK(deleted_on != std::this_thread::get_id());
+
+    for (int i = 0; i < 100; ++i) {
+        SharedPtr<Counted>(new Counted(i), deleteOn<Counted>(executor));
+    }
+}
+
+TEST(AsyncDeleterFallsBackInline) {
+    RefusingExecutor executor;
+    SharedPtr<Counted>(new Counted(7), deleteOn<Counted>(executor)).reset();
+    CHECK(Counted::live == 0);
+}
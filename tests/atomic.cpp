@@ -0,0 +1,72 @@
+#include <thread>
+#include <vector>
+
+#include "atomic_shared_ptr.h"
+#include "check.h"
+
+TEST(AtomicSharedPtrOperations) {
+    {
+        AtomicSharedPtr<Counted> atomic(makeShared<Counted>(1));
+        CHECK(atomic.load()->value == 1);
+        atomic.store(makeShared<Counted>(2));
+        CHECK(Counted::live == 1);
+
+        SharedPtr<Counted> previous = atomic.exchange(makeShared<Counted>(3));
+        CHECK(previous->value == 2);
+        CHECK(previous.use_count() == 1);
+
+        SharedPtr<Counted> expected = previous;
+        CHECK(!atomic.compare_exchange_strong(expected,
+                                              makeShared<Counted>(4)));
+        CHECK(expected->value == 3);
+        CHECK(expected.use_count() == 2);
+        CHECK(atomic.compare_exchange_strong(expected,
+                                             makeShared<Counted>(5)));
+        CHECK(expected.use_count() == 1);
+
+        SharedPtr<Counted> current = atomic;
+        CHECK(current->value == 5);
+        atomic = SharedPtr<Counted>();
+        CHECK(atomic.load().get() == nullptr);
+        CHECK(current.use_count() == 1);
+    }
+    CHECK(Counted::live == 0);
+}
+
+// Writers replace the value through compare-exchange while readers load
+// it: no update is lost and readers never see it go backwards.
+TEST(AtomicSharedPtrConcurrentUpdates) {
+    constexpr int kWriters = 4;
+    constexpr int kReaders = 2;
+    constexpr int kRounds = 2000;
+    {
+        AtomicSharedPtr<Counted> atomic(makeShared<Counted>(0));
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kWriters; ++i) {
+            threads.emplace_back([&atomic] {
+                for (int round = 0; round < kRounds; ++round) {
+                    SharedPtr<Counted> current = atomic.load();
+                    while (!atomic.compare_exchange_weak(
+                        current, makeShared<Counted>(current->value + 1))) {
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < kReaders; ++i) {
+            threads.emplace_back([&atomic] {
+                int seen = 0;
+                while (seen < kWriters * kRounds) {
+                    SharedPtr<Counted> current = atomic.load();
+                    CHECK(current->value >= seen);
+                    seen = current->value;
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        CHECK(atomic.load()->value == kWriters * kRounds);
+        CHECK(Counted::live == 1);
+    }
+    CHECK(Counted::live == 0);
+}
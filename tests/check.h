@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// A minimal harness that does not depend on NDEBUG: CHECK reports the
+// failed condition and aborts, TEST registers a function that main() runs.
+#define CHECK(condition)                                                 \
+    do {                                                                 \
+        if (!(condition)) {                                              \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,  \
+                         __LINE__, #condition);                          \
+            std::abort();                                                \
+        }                                                                \
+    } while (false)
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<TestCase>& testCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+struct TestRegistration {
+    TestRegistration(const char* name, void (*run)()) {
+        testCases().push_back(TestCase{name, run});
+    }
+};
+
+#define TEST(name)                                                   \
+    static void name();                                              \
+    static const TestRegistration name##_registration(#name, name);  \
+    static void name()
+
+// Counts live instances, so a test can tell when an object is destroyed,
+// including by another thread.
+struct Counted {
+    static inline std::atomic<int> live{0};
+
+    int value;
+
+    explicit Counted(int value = 0) : value(value) {
+        ++live;
+    }
+
+    Counted(const Counted& other) : value(other.value) {
+        ++live;
+    }
+
+    ~Counted() {
+        --live;
+    }
+};
@@ -0,0 +1,128 @@
+#include <functional>
+#include <set>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "check.h"
+#include "smart_pointers.h"
+#include "weak_value_cache.h"
+
+namespace {
+
+struct Pair {
+    int first;
+    int second;
+};
+
+}  // namespace
+
+TEST(PointerComparisons) {
+    auto first = makeShared<int>(1);
+    auto second = makeShared<int>(2);
+    SharedPtr<int> copy = first;
+    SharedPtr<int> empty;
+
+    CHECK(first == copy);
+    CHECK(first != second);
+    CHECK((first < second) == std::less<int*>()(first.get(), second.get()));
+    CHECK((first > second) == (second < first));
+    CHECK(first <= copy && first >= copy);
+    CHECK(empty == nullptr && nullptr == empty);
+    CHECK(first != nullptr && nullptr != first);
+    CHECK(std::hash<SharedPtr<int>>()(first) ==
+          std::hash<int*>()(first.get()));
+
+    std::unordered_set<SharedPtr<int>> set{first, copy, second};
+    CHECK(set.size() == 2);
+}
+
+// Aliasing pointers into one object share their owner, and WeakPtrs keep
+// it as a key after the object is gone.
+TEST(OwnerOrdering) {
+    auto pair = makeShared<Pair>();
+    SharedPtr<int> first(pair, &pair->first);
+    SharedPtr<int> second(pair, &pair->second);
+    auto other = makeShared<int>(3);
+    WeakPtr<int> weak(first);
+
+    CHECK(first != second);
+    CHECK(first.ownerEquals(second));
+    CHECK(!first.ownerBefore(second) && !second.ownerBefore(first));
+    CHECK(first.ownerBefore(other) != other.ownerBefore(first));
+    CHECK(OwnerEqual()(weak, second));
+    CHECK(OwnerHash()(weak) == OwnerHash()(second));
+    CHECK(std::hash<WeakPtr<int>>()(weak) == second.ownerHash());
+
+    std::set<WeakPtr<int>, OwnerLess> owners{weak, WeakPtr<int>(other)};
+    CHECK(owners.count(second) == 1);
+    pair.reset();
+    first.reset();
+    second.reset();
+    CHECK(weak.expired());
+    CHECK(owners.count(weak) == 1);
+    CHECK(owners.size() == 2);
+}
+
+TEST(WeakValueCacheLookups) {
+    WeakValueCache<int, Counted> cache;
+    auto value = makeShared<Counted>(7);
+    cache.insert(1, value);
+    CHECK(cache.find(1).get() == value.get());
+    CHECK(cache.find(2).get() == nullptr);
+
+    int made = 0;
+    auto make = [&made] {
+        ++made;
+        return makeShared<Counted>(8);
+    };
+    CHECK(cache.findOrInsert(1, make).get() == value.get());
+    CHECK(made == 0);
+
+    value.reset();
+    CHECK(Counted::live == 0);
+    CHECK(cache.find(1).get() == nullptr);
+    auto fresh = cache.findOrInsert(1, make);
+    CHECK(made == 1);
+    CHECK(fresh->value == 8);
+    cache.erase(1);
+    CHECK(cache.find(1).get() == nullptr);
+    CHECK(fresh.use_count() == 1);
+}
+
+// Expired entries are swept as inserts go on, and all of them by purge().
+TEST(WeakValueCacheSweeps) {
+    constexpr int kEntries = 4096;
+    WeakValueCache<int, Counted> cache;
+    auto kept = makeShared<Counted>(-1);
+    cache.insert(-1, kept);
+    for (int i = 0; i < kEntries; ++i) {
+        cache.insert(i, makeShared<Counted>(i));
+    }
+    CHECK(cache.size() < kEntries);
+    cache.purge();
+    CHECK(cache.size() == 1);
+    CHECK(cache.find(-1).get() == kept.get());
+}
+
+TEST(WeakValueCacheCreatesOnce) {
+    WeakValueCache<int, Counted> cache;
+    std::atomic<int> made{0};
+    std::vector<SharedPtr<Counted>> results(4);
+    std::vector<std::thread> threads;
+    for (SharedPtr<Counted>& result : results) {
+        threads.emplace_back([&cache, &made, &result] {
+            result = cache.findOrInsert(42, [&made] {
+                ++made;
+                return makeShared<Counted>(42);
+            });
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(made == 1);
+    for (const SharedPtr<Counted>& result : results) {
+        CHECK(result == results[0]);
+    }
+}
@@ -0,0 +1,129 @@
+#include <utility>
+
+#include "check.h"
+#include "smart_pointers.h"
+
+namespace {
+
+struct Base : Counted {
+    virtual ~Base() = default;
+};
+
+struct Derived : Base {};
+
+struct Other : Base {};
+
+struct Pair {
+    Counted first;
+    Counted second;
+};
+
+struct Node : Counted, EnableSharedFromThis<Node> {};
+
+}  // namespace
+
+TEST(PointerCasts) {
+    SharedPtr<Base> base = makeShared<Derived>();
+    SharedPtr<Derived> derived = staticPointerCast<Derived>(base);
+    CHECK(derived.get() == base.get());
+    CHECK(base.use_count() == 2);
+
+    CHECK(dynamicPointerCast<Derived>(base).get() == base.get());
+    CHECK(dynamicPointerCast<Other>(base).get() == nullptr);
+    CHECK(base.use_count() == 2);
+
+    SharedPtr<const Base> constant = base;
+    SharedPtr<Base> mutated = constPointerCast<Base>(constant);
+    CHECK(mutated.get() == base.get());
+    CHECK(base.use_count() == 4);
+    mutated.reset();
+    constant.reset();
+    derived.reset();
+    CHECK(base.use_count() == 1);
+}
+
+// Casting an rvalue hands its reference over instead of taking a new one;
+// a failed dynamic cast leaves the source as it was.
+TEST(RvalueCasts) {
+    SharedPtr<Base> base = makeShared<Derived>();
+    const Base* object = base.get();
+    SharedPtr<Derived> derived = staticPointerCast<Derived>(std::move(base));
+    CHECK(base.get() == nullptr);
+    CHECK(derived.get() == object);
+    CHECK(derived.use_count() == 1);
+
+    SharedPtr<Other> other = dynamicPointerCast<Other>(std::move(derived));
+    CHECK(other.get() == nullptr);
+    CHECK(derived.get() == object);
+
+    SharedPtr<Base> back = dynamicPointerCast<Base>(std::move(derived));
+    CHECK(derived.get() == nullptr);
+    CHECK(back.use_count() == 1);
+
+    SharedPtr<const Base> constant = std::move(back);
+    SharedPtr<Base> mutated = constPointerCast<Base>(std::move(constant));
+    CHECK(constant.get() == nullptr);
+    CHECK(mutated.use_count() == 1);
+    mutated.reset();
+    CHECK(Counted::live == 0);
+}
+
+TEST(AliasingPointers) {
+    auto pair = makeShared<Pair>();
+    SharedPtr<Counted> second(pair, &pair->second);
+    CHECK(pair.use_count() == 2);
+    SharedPtr<Counted> first(std::move(second), &pair->first);
+    CHECK(second.get() == nullptr);
+    CHECK(first.get() == &pair->first);
+    CHECK(pair.use_count() == 2);
+
+    pair.reset();
+    CHECK(Counted::live == 2);
+    CHECK(first.use_count() == 1);
+    first.reset();
+    CHECK(Counted::live == 0);
+}
+
+TEST(SharedFromThis) {
+    auto node = makeShared<Node>();
+    SharedPtr<Node> self = node->sharedFromThis();
+    CHECK(self.get() == node.get());
+    CHECK(node.use_count() == 2);
+    const Node& constant = *node;
+    SharedPtr<const Node> constSelf = constant.sharedFromThis();
+    CHECK(constSelf.get() == node.get());
+    CHECK(node.use_count() == 3);
+
+    auto adopted = SharedPtr<Node>(new Node);
+    CHECK(adopted->sharedFromThis().get() == adopted.get());
+
+    Node unowned;
+    CHECK(unowned.sharedFromThis().get() == nullptr);
+    CHECK(unowned.weakFromThis().expired());
+
+    WeakPtr<Node> weak = node->weakFromThis();
+    node.reset();
+    self.reset();
+    constSelf.reset();
+    CHECK(weak.expired());
+    adopted.reset();
+    CHECK(Counted::live == 1);
+}
+
+TEST(BorrowedPromote) {
+    auto derived = makeShared<Derived>();
+    BorrowedPtr<Base> borrowed = derived;
+    BorrowedPtr<Base> copy = borrowed;
+    CHECK(derived.use_count() == 1);
+    CHECK(copy.get() == derived.get());
+
+    SharedPtr<Base> owned = copy.promote();
+    CHECK(owned.get() == derived.get());
+    CHECK(derived.use_count() == 2);
+    derived.reset();
+    CHECK(Counted::live == 1);
+    owned.reset();
+    CHECK(Counted::live == 0);
+
+    CHECK(BorrowedPtr<Base>().promote().get() == nullptr);
+}
@@ -0,0 +1,370 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "biased_policy.h"
+#include "check.h"
+#include "compact_policy.h"
+#include "deferred_policy.h"
+#include "epoch_policy.h"
+#include "instrumented_policy.h"
+#include "pool_allocator.h"
+#include "smart_pointers.h"
+#include "tracked_policy.h"
+
+namespace {
+
+// Completes whatever release the policy postpones.
+template <typename Policy>
+void settle() {
+    if constexpr (std::is_same_v<Policy, DeferredPolicy>) {
+        drainRetired();
+    } else if constexpr (std::is_same_v<Policy, EpochPolicy>) {
+        for (int i = 0; i < 3; ++i) {
+            reclaimEpochRetired();
+        }
+    }
+}
+
+template <typename Policy>
+void checkOwnership(SharedPtr<Counted, Policy> first) {
+    WeakPtr<Counted, Policy> weak(first);
+    CHECK(first.use_count() == 1);
+    CHECK(!weak.expired());
+    {
+        SharedPtr<Counted, Policy> second = first;
+        CHECK(first.use_count() == 2);
+        CHECK(second.get() == first.get());
+    }
+    CHECK(first.use_count() == 1);
+
+    SharedPtr<Counted, Policy> locked = weak.lock();
+    CHECK(locked.get() == first.get());
+    CHECK(locked->value == 7);
+    first.reset();
+    CHECK(!weak.expired());
+    CHECK(Counted::live == 1);
+
+    locked.reset();
+    CHECK(weak.expired());
+    CHECK(weak.lock().get() == nullptr);
+    settle<Policy>();
+    CHECK(Counted::live == 0);
+}
+
+template <typename Policy>
+void checkLifetime() {
+    CHECK(Counted::live == 0);
+    checkOwnership(makeShared<Counted, Policy>(7));
+    checkOwnership(SharedPtr<Counted, Policy>(new Counted(7)));
+    checkOwnership(
+        allocateShared<Counted, Policy>(std::allocator<Counted>(), 7));
+
+    // The block outlives the object while a WeakPtr holds it.
+    WeakPtr<Counted, Policy> weak;
+    {
+        auto batch = makeSharedBatch<Counted, Policy>(3, 7);
+        CHECK(Counted::live == 3);
+        weak = batch[1];
+        batch.pop_back();
+        settle<Policy>();
+        CHECK(Counted::live == 2);
+    }
+    settle<Policy>();
+    CHECK(Counted::live == 0);
+    CHECK(weak.expired());
+    weak = WeakPtr<Counted, Policy>();
+
+    SharedPtr<Counted[], Policy> array = makeShared<Counted[], Policy>(4);
+    CHECK(Counted::live == 4);
+    WeakPtr<Counted[], Policy> weakArray(array);
+    array.reset();
+    CHECK(weakArray.expired());
+    settle<Policy>();
+    CHECK(Counted::live == 0);
+}
+
+// Releases an object from a thread-local destroyed after the policy's own
+// thread-locals, as destructors of statics do on the main thread.
+template <typename Policy>
+void checkReleaseAfterTeardown() {
+    std::thread([] {
+        thread_local SharedPtr<Counted, Policy> late;
+        makeShared<Counted, Policy>(7).reset();
+        late = makeShared<Counted, Policy>(7);
+    }).join();
+    settle<Policy>();
+    CHECK(Counted::live == 0);
+}
+
+}  // namespace
+
+TEST(LocalLifetime) {
+    checkLifetime<LocalPolicy>();
+}
+
+TEST(AtomicLifetime) {
+    checkLifetime<AtomicPolicy>();
+}
+
+TEST(BiasedLifetime) {
+    checkLifetime<BiasedPolicy>();
+}
+
+TEST(DeferredLifetime) {
+    checkLifetime<DeferredPolicy>();
+}
+
+TEST(EpochLifetime) {
+    checkLifetime<EpochPolicy>();
+}
+
+TEST(InstrumentedLifetime) {
+    checkLifetime<InstrumentedPolicy<>>();
+}
+
+TEST(TrackedLifetime) {
+    checkLifetime<TrackedPolicy<>>();
+}
+
+TEST(CompactLifetime) {
+    checkLifetime<CompactAtomicPolicy>();
+    checkLifetime<CompactLocalPolicy>();
+}
+
+TEST(DeferredKeepsObjectUntilDrained) {
+    WeakPtr<Counted, DeferredPolicy> weak;
+    {
+        auto shared = makeShared<Counted, DeferredPolicy>(7);
+        weak = shared;
+    }
+    CHECK(weak.expired());
+    CHECK(Counted::live == 1);
+    drainRetired();
+    CHECK(Counted::live == 0);
+}
+
+namespace {
+
+struct Flagged {
+    std::atomic<bool>* destroyed;
+
+    explicit Flagged(std::atomic<bool>* destroyed) : destroyed(destroyed) {}
+
+    ~Flagged() {
+        destroyed->store(true);
+    }
+};
+
+}  // namespace
+
+// Far fewer blocks than a batch: the reclaimer still gets them once the
+// thread retires again.
+TEST(DeferredReclaimerCollectsPartialBatches) {
+    std::atomic<bool> destroyed{false};
+    DeferredReclaimer reclaimer(std::chrono::milliseconds(1));
+    makeShared<Flagged, DeferredPolicy>(&destroyed).reset();
+    for (int i = 0; i < 100 && !destroyed.load(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        makeShared<int, DeferredPolicy>(0).reset();
+    }
+    CHECK(destroyed.load());
+    drainRetired();
+}
+
+TEST(DeferredReleaseAfterTeardown) {
+    checkReleaseAfterTeardown<DeferredPolicy>();
+}
+
+TEST(EpochProtectKeepsObject) {
+    auto shared = makeShared<Counted, EpochPolicy>(7);
+    WeakPtr<Counted, EpochPolicy> weak(shared);
+    {
+        auto guard = weak.protect();
+        CHECK(guard && guard->value == 7);
+        shared.reset();
+        settle<EpochPolicy>();
+        CHECK(Counted::live == 1);
+        CHECK(guard->value == 7);
+    }
+    settle<EpochPolicy>();
+    CHECK(Counted::live == 0);
+    CHECK(!weak.protect());
+}
+
+TEST(EpochReleaseAfterTeardown) {
+    checkReleaseAfterTeardown<EpochPolicy>();
+}
+
+// The block goes back to the pool after the thread's cache is destroyed.
+TEST(PoolReleaseAfterTeardown) {
+    for (int i = 0; i < 2; ++i) {
+        std::thread([] {
+            thread_local SharedPtr<Counted> late;
+            late = allocateShared<Counted>(PoolAllocator<Counted>(), 7);
+        }).join();
+    }
+    CHECK(Counted::live == 0);
+}
+
+// The last reference is dropped on a thread other than the owner, which
+// stays idle: the object must go at once and never come back.
+TEST(BiasedReleaseOffOwner) {
+    auto shared = makeShared<Counted, BiasedPolicy>(7);
+    WeakPtr<Counted, BiasedPolicy> weak(shared);
+    std::thread([moved = std::move(shared)]() mutable { moved.reset(); })
+        .join();
+    CHECK(Counted::live == 0);
+    std::thread([&weak] {
+        CHECK(weak.expired());
+        CHECK(weak.use_count() == 0);
+        CHECK(weak.lock().get() == nullptr);
+    }).join();
+    CHECK(weak.expired());
+    CHECK(weak.lock().get() == nullptr);
+}
+
+TEST(BiasedOwnerKeepsObject) {
+    auto shared = makeShared<Counted, BiasedPolicy>(7);
+    WeakPtr<Counted, BiasedPolicy> weak(shared);
+    std::thread([copy = shared]() mutable { copy.reset(); }).join();
+    std::thread([&weak] {
+        CHECK(!weak.expired());
+        CHECK(weak.lock()->value == 7);
+    }).join();
+    CHECK(shared.use_count() == 1);
+    shared.reset();
+    CHECK(Counted::live == 0);
+    CHECK(weak.expired());
+}
+
+TEST(BiasedMigratingReferences) {
+    constexpr int kThreads = 4;
+    constexpr int kRounds = 200;
+    for (int round = 0; round < kRounds; ++round) {
+        auto shared = makeShared<Counted, BiasedPolicy>(7);
+        WeakPtr<Counted, BiasedPolicy> weak(shared);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([copy = shared, &weak]() mutable {
+                SharedPtr<Counted, BiasedPolicy> locked = weak.lock();
+                CHECK(locked.get() != nullptr);
+                copy.reset();
+            });
+        }
+        shared.reset();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        CHECK(Counted::live == 0);
+        CHECK(weak.lock().get() == nullptr);
+    }
+}
+
+TEST(AdoptedArraysUseDeleteArray) {
+    SharedPtr<Counted[4]> bounded(new Counted[4]);
+    SharedPtr<Counted[]> unbounded(new Counted[3]);
+    CHECK(Counted::live == 7);
+    bounded.reset(new Counted[4]);
+    unbounded.reset(new Counted[2]);
+    CHECK(Counted::live == 6);
+    bounded.reset();
+    unbounded.reset();
+    CHECK(Counted::live == 0);
+}
+
+namespace {
+
+struct Self : Counted, EnableSharedFromThis<Self> {};
+
+}  // namespace
+
+TEST(WeakFromThis) {
+    auto self = makeShared<Self>();
+    const Self& object = *self;
+    WeakPtr<const Self> weak = object.weakFromThis();
+    CHECK(self.use_count() == 1);
+    CHECK(weak.lock().get() == self.get());
+    self.reset();
+    CHECK(weak.expired());
+    CHECK(Counted::live == 0);
+}
+
+namespace {
+
+struct Intrusive : Counted, IntrusiveRefCounted<> {};
+
+}  // namespace
+
+TEST(IntrusiveReadoption) {
+    auto* raw = new Intrusive;
+    SharedPtr<Intrusive> first(raw);
+    SharedPtr<Intrusive> again(raw);
+    CHECK(first.use_count() == 2);
+    WeakPtr<Intrusive> weak(first);
+    first.reset();
+    again.reset();
+    CHECK(weak.expired());
+    CHECK(Counted::live == 1);
+
+    // Expired but still held by the WeakPtr, so it can be adopted again.
+    SharedPtr<Intrusive> revived(raw);
+    CHECK(revived.use_count() == 1);
+    CHECK(weak.lock().get() == raw);
+    revived.reset();
+    CHECK(Counted::live == 1);
+    weak = WeakPtr<Intrusive>();
+    CHECK(Counted::live == 0);
+
+    SharedPtr<Intrusive>(new Intrusive).reset();
+    CHECK(Counted::live == 0);
+}
+
+namespace {
+
+class PrivateDestructor : public Counted {
+    ~PrivateDestructor() = default;
+
+    friend struct PrivateDeleter;
+};
+
+struct PrivateDeleter {
+    void operator()(PrivateDestructor* object) const {
+        delete object;
+    }
+};
+
+class ProtectedDestructor : public Counted {
+  protected:
+    ~ProtectedDestructor() = default;
+};
+
+struct Public : ProtectedDestructor {};
+
+}  // namespace
+
+// Only the deleter, or the block of the derived object, may destroy these;
+// releasing them must not need a destructor the pointer cannot reach.
+TEST(InaccessibleDestructors) {
+    SharedPtr<PrivateDestructor> deleted(new PrivateDestructor,
+                                         PrivateDeleter());
+    SharedPtr<ProtectedDestructor> derived = makeShared<Public>();
+    CHECK(Counted::live == 2);
+    deleted.reset();
+    derived.reset();
+    CHECK(Counted::live == 0);
+}
+
+// Borrows may outlive their source as long as they are not dereferenced;
+// the object still goes with its last owner.
+TEST(BorrowOutlivesSource) {
+    auto shared = makeShared<Counted>(7);
+    BorrowedPtr<Counted> borrowed = shared;
+    BorrowedPtr<Counted> copy = borrowed;
+    copy = BorrowedPtr<Counted>(shared);
+    CHECK(copy->value == 7);
+    shared.reset();
+    CHECK(Counted::live == 0);
+}
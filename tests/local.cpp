@@ -0,0 +1,46 @@
+#include <thread>
+#include <type_traits>
+
+#include "check.h"
+#include "local_shared_ptr.h"
+
+static_assert(!std::is_same_v<decltype(share(std::declval<
+                                             const LocalSharedPtr<int>&>())),
+                              LocalSharedPtr<int>>,
+              "shared references must be told apart from local ones");
+
+TEST(LocalSharedCounts) {
+    LocalSharedPtr<Counted> local = makeLocalShared<Counted>(7);
+    LocalWeakPtr<Counted> weak(local);
+    LocalSharedPtr<Counted> copy = local;
+    CHECK(local.use_count() == 2);
+    copy.reset();
+    local.reset();
+    CHECK(weak.expired());
+    CHECK(Counted::live == 0);
+}
+
+TEST(ShareCrossesThreads) {
+    LocalSharedPtr<Counted> local = makeLocalShared<Counted>(7);
+    SharedModePtr<Counted> shared = share(local);
+    CHECK(shared.get() == local.get());
+    CHECK(share(local).get() == local.get());
+    local.reset();
+    CHECK(shared.use_count() == 1);
+
+    std::thread threads[4];
+    for (std::thread& thread : threads) {
+        thread = std::thread([shared] {
+            for (int i = 0; i < 1000; ++i) {
+                LocalSharedPtr<Counted> copy = shared.local();
+                CHECK(copy->value == 7);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(shared.use_count() == 1);
+    shared.reset();
+    CHECK(Counted::live == 0);
+}
@@ -0,0 +1,12 @@
+#include <cstdio>
+
+#include "check.h"
+
+int main() {
+    for (const TestCase& test : testCases()) {
+        std::printf("%s\n", test.name);
+        test.run();
+    }
+    std::printf("%zu tests passed\n", testCases().size());
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#if __has_include(<sys/wait.h>)
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#define SMART_POINTERS_TEST_FORK 1
+#endif
+
+#include "check.h"
+#include "compact_policy.h"
+#include "smart_pointers.h"
+#include "tracked_policy.h"
+
+namespace {
+
+// Its own registry, apart from the blocks of other tests.
+using Tracked = TrackedPolicy<LocalPolicy>;
+
+struct Link : Counted {
+    SharedPtr<Link, Tracked> next;
+
+    template <typename Visitor>
+    void visitChildren(Visitor&& visit) const {
+        visit(next);
+    }
+};
+
+template <typename Policy>
+void checkSaturates() {
+    typename Policy::count_type count{Policy::kLimit - 1};
+    Policy::increment(count);
+    CHECK(Policy::load(count) == Policy::kLimit);
+    Policy::increment(count);
+    CHECK(Policy::load(count) == Policy::kSaturated);
+    CHECK(Policy::decrement(count) == Policy::kSaturated);
+    CHECK(Policy::incrementIfNonZero(count));
+    CHECK(Policy::load(count) == Policy::kSaturated);
+}
+
+#ifdef SMART_POINTERS_TEST_FORK
+// Runs `body` in a child process and tells whether it died of SIGABRT.
+template <typename F>
+bool aborts(F&& body) {
+    pid_t child = fork();
+    if (child == 0) {
+        body();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+#endif
+
+}  // namespace
+
+TEST(TrackedFindsCycles) {
+    auto first = makeShared<Link, Tracked>();
+    auto second = makeShared<Link, Tracked>();
+    first->next = second;
+    second->next = first;
+    WeakPtr<Link, Tracked> weak(first);
+    CHECK(Tracked::heapSnapshot().size() == 2);
+    CHECK(Tracked::findCycles().empty());
+
+    // Still reachable through the outside reference to the second.
+    first.reset();
+    CHECK(Tracked::findCycles().empty());
+
+    second.reset();
+    std::vector<Tracked::LiveBlock> garbage = Tracked::findCycles();
+    CHECK(garbage.size() == 2);
+    CHECK(garbage[0].use_count == 1);
+    CHECK(*garbage[0].type == typeid(Link));
+
+    weak.lock()->next.reset();
+    CHECK(Counted::live == 0);
+    CHECK(Tracked::findCycles().empty());
+    std::vector<Tracked::LiveBlock> live = Tracked::heapSnapshot();
+    CHECK(live.size() == 1);
+    CHECK(live[0].use_count == 0);
+    CHECK(live[0].weak_count == 1);
+}
+
+TEST(CompactCountsSaturate) {
+    checkSaturates<CompactPolicy<true, CountOverflow::saturate>>();
+    checkSaturates<CompactPolicy<false, CountOverflow::saturate>>();
+}
+
+#ifdef SMART_POINTERS_TEST_FORK
+TEST(CompactCountsAbort) {
+    using Policy = CompactAtomicPolicy;
+    CHECK(aborts([] {
+        Policy::count_type count{Policy::kLimit};
+        Policy::increment(count);
+    }));
+    CHECK(!aborts([] {
+        Policy::count_type count{Policy::kLimit - 1};
+        Policy::increment(count);
+    }));
+}
+#endif
+
+// Copies from any number of threads leave the counts alone, and the object
+// never expires.
+TEST(ImmortalObjects) {
+    static const SharedPtr<std::string> forever =
+        makeImmortal<std::string>("forever");
+    WeakPtr<std::string> weak(forever);
+    CHECK(forever.use_count() == 1);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([] {
+            for (int round = 0; round < 1000; ++round) {
+                SharedPtr<std::string> copy = forever;
+                CHECK(*copy == "forever");
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(forever.use_count() == 1);
+
+    SharedPtr<std::string> last = weak.lock();
+    weak = WeakPtr<std::string>();
+    last.reset();
+    CHECK(*forever == "forever");
+    CHECK(forever.use_count() == 1);
+}
@@ -0,0 +1,86 @@
+#include <cstdint>
+
+#include "check.h"
+#include "shared_ptr_queue.h"
+#include "smart_pointers.h"
+
+namespace {
+
+// Too far from its block for the offset to fit in the packed word.
+struct Distant {
+    char padding[1 << 16];
+    Counted counted;
+};
+
+template <typename Policy>
+void checkRoundTrip(SharedPtr<Counted, Policy> shared) {
+    Counted* object = shared.get();
+    WeakPtr<Counted, Policy> weak(shared);
+    uintptr_t word = shared.release();
+    CHECK(word != 0);
+    CHECK(shared.get() == nullptr);
+    CHECK(!weak.expired());
+
+    auto adopted = SharedPtr<Counted, Policy>::adoptRaw(word);
+    CHECK(adopted.get() == object);
+    CHECK(adopted.use_count() == 1);
+    adopted.reset();
+    CHECK(weak.expired());
+    CHECK(Counted::live == 0);
+}
+
+}  // namespace
+
+TEST(RawRoundTrip) {
+    // Packed into the word itself.
+    checkRoundTrip(makeShared<Counted>(1));
+    checkRoundTrip(makeShared<Counted, LocalPolicy>(1));
+    auto batch = makeSharedBatch<Counted>(1, 1);
+    checkRoundTrip(std::move(batch[0]));
+    batch.clear();
+
+    // Boxed.
+    checkRoundTrip(SharedPtr<Counted>(new Counted(1)));
+    auto distant = makeShared<Distant>();
+    SharedPtr<Counted> alias(distant, &distant->counted);
+    distant.reset();
+    checkRoundTrip(std::move(alias));
+}
+
+TEST(RawEmpty) {
+    SharedPtr<Counted> empty;
+    CHECK(empty.release() == 0);
+    CHECK(SharedPtr<Counted>::adoptRaw(0).get() == nullptr);
+}
+
+namespace {
+
+template <typename Queue>
+void checkFullQueue() {
+    Queue queue(2);
+    SharedPtr<Counted> packed = makeShared<Counted>(1);
+    SharedPtr<Counted> boxed(new Counted(2));
+    CHECK(queue.tryPush(SharedPtr<Counted>(packed)));
+    CHECK(queue.tryPush(SharedPtr<Counted>(boxed)));
+    // A failed push leaves the pointer untouched.
+    CHECK(!queue.tryPush(packed));
+    CHECK(!queue.tryPush(boxed));
+    CHECK(packed.use_count() == 2);
+    CHECK(boxed.use_count() == 2);
+
+    SharedPtr<Counted> popped;
+    CHECK(queue.tryPop(popped));
+    CHECK(popped.get() == packed.get());
+    CHECK(queue.tryPop(popped));
+    CHECK(popped.get() == boxed.get());
+    CHECK(!queue.tryPop(popped));
+    CHECK(boxed.use_count() == 2);
+}
+
+}  // namespace
+
+TEST(FullQueuesKeepValue) {
+    checkFullQueue<SpscSharedPtrQueue<Counted>>();
+    checkFullQueue<MpmcSharedPtrQueue<Counted>>();
+    CHECK(Counted::live == 0);
+}
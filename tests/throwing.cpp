@@ -0,0 +1,104 @@
+#include <stdexcept>
+
+#include "check.h"
+#include "smart_pointers.h"
+
+namespace {
+
+// Throws from the constructor once `countdown` more instances were made.
+struct Fragile : Counted {
+    static inline int countdown = -1;
+
+    Fragile() : Counted() {
+        if (countdown >= 0 && countdown-- == 0) {
+            throw std::runtime_error("fragile");
+        }
+    }
+};
+
+// Counts the bytes an allocator hands out and gets back.
+struct Usage {
+    size_t allocated = 0;
+    size_t deallocated = 0;
+};
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    Usage* usage;
+
+    explicit CountingAllocator(Usage* usage) : usage(usage) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other)
+        : usage(other.usage) {}
+
+    T* allocate(size_t n) {
+        usage->allocated += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        usage->deallocated += n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>& other) const {
+        return usage == other.usage;
+    }
+
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>& other) const {
+        return usage != other.usage;
+    }
+};
+
+template <typename F>
+void checkThrows(int countdown, F&& make) {
+    Fragile::countdown = countdown;
+    bool thrown = false;
+    try {
+        make();
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    Fragile::countdown = -1;
+    CHECK(thrown);
+    CHECK(Counted::live == 0);
+}
+
+}  // namespace
+
+TEST(MakeSharedThrows) {
+    Usage usage;
+    checkThrows(0, [&] {
+        allocateShared<Fragile>(CountingAllocator<Fragile>(&usage));
+    });
+    CHECK(usage.allocated != 0);
+    CHECK(usage.deallocated == usage.allocated);
+}
+
+TEST(ArrayThrows) {
+    checkThrows(5, [] { makeShared<Fragile[]>(8); });
+    checkThrows(0, [] { makeShared<Fragile[4]>(); });
+
+    Usage usage;
+    checkThrows(3, [&] {
+        allocateShared<Fragile[]>(CountingAllocator<Fragile>(&usage), 8);
+    });
+    CHECK(usage.allocated != 0);
+    CHECK(usage.deallocated == usage.allocated);
+}
+
+TEST(BatchThrows) {
+    checkThrows(7, [] { makeSharedBatch<Fragile>(16); });
+
+    Usage usage;
+    checkThrows(2, [&] {
+        allocateSharedBatch<Fragile>(CountingAllocator<Fragile>(&usage), 4);
+    });
+    CHECK(usage.allocated != 0);
+    CHECK(usage.deallocated == usage.allocated);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// Set by the destructor of the thread_local identified by Tag, for code
+// that may run after it on the same thread, such as destructors of statics
+// or of other thread-locals. The flag itself is trivially destructible, so
+// it can still be read once the thread's other thread-locals are gone.
+template <typename Tag>
+bool& threadLocalDestroyed() {
+    thread_local bool destroyed = false;
+    return destroyed;
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#define SMART_POINTERS_HAS_DEMANGLE 1
+#endif
+
+#include "smart_pointers.h"
+
+// Debug policy that keeps a registry of every live control block, for
+// finding leaks in long-running processes without external tools. Counts
+// behave as in Base (LocalPolicy or AtomicPolicy); creating and freeing a
+// block additionally takes a global lock.
+//
+// Types that expose the SharedPtrs they own through
+//
+//     template <typename Visitor>
+//     void visitChildren(Visitor&& visit) const;  // visit(child) for each
+//
+// take part in findCycles(), which reports groups of objects kept alive
+// only by references among themselves.
+template <typename Base = AtomicPolicy>
+struct TrackedPolicy : Base {
+    using ControlBlock = BaseControlBlock<TrackedPolicy>;
+
+    struct LiveBlock {
+        const void* block;
+        const void* object;
+        const std::type_info* type;  // nullptr for incomplete types
+        size_t bytes;
+        size_t use_count;
+        size_t weak_count;
+    };
+
+    template <typename T>
+    static void onAllocate(ControlBlock* cb, const T* object, size_t bytes) {
+        Entry entry{nullptr, object, bytes, nullptr};
+        if constexpr (is_complete<T>::value) {
+            entry.type = &typeid(T);
+            if constexpr (has_children<T>::value) {
+                entry.children = &collectChildren<T>;
+            }
+        }
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        all.blocks.emplace(cb, entry);
+    }
+
+    static void onDeallocate(ControlBlock* cb) {
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        all.blocks.erase(cb);
+    }
+
+    // Blocks whose use count is zero have destroyed their object and are
+    // only held by weak references.
+    static std::vector<LiveBlock> heapSnapshot() {
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        std::vector<LiveBlock> live;
+        live.reserve(all.blocks.size());
+        for (const auto& [cb, entry] : all.blocks) {
+            live.push_back(describe(cb, entry));
+        }
+        return live;
+    }
+
+    // Per type: number of live blocks, bytes, and how many are expired.
+    static void printHeapSnapshot(std::ostream& out) {
+        struct Summary {
+            size_t blocks = 0;
+            size_t bytes = 0;
+            size_t expired = 0;
+        };
+        std::map<std::string, Summary> by_type;
+        for (const LiveBlock& block : heapSnapshot()) {
+            Summary& summary = by_type[typeName(block.type)];
+            ++summary.blocks;
+            summary.bytes += block.bytes;
+            summary.expired += block.use_count == 0 ? 1 : 0;
+        }
+        for (const auto& [name, summary] : by_type) {
+            out << summary.blocks << " blocks, " << summary.bytes
+                << " bytes, " << summary.expired << " expired: " << name
+                << '\n';
+        }
+    }
+
+    // Trial deletion over the whole registry: references from tracked
+    // children are subtracted from every use count, and whatever cannot be
+    // reached from a block with references left over is garbage held alive
+    // by a cycle. The tracked graph must not be mutated during the scan.
+    static std::vector<LiveBlock> findCycles() {
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+
+        struct Node {
+            size_t internal = 0;
+            bool reachable = false;
+            std::vector<const ControlBlock*> children;
+        };
+        std::unordered_map<const ControlBlock*, Node> nodes;
+        for (const auto& [cb, entry] : all.blocks) {
+            if (Base::load(cb->shared_count) != 0) {
+                Node& node = nodes[cb];
+                if (entry.children != nullptr) {
+                    entry.children(entry.object, node.children);
+                }
+            }
+        }
+
+        for (const auto& [cb, node] : nodes) {
+            for (const ControlBlock* child : node.children) {
+                auto found = nodes.find(child);
+                if (found != nodes.end()) {
+                    ++found->second.internal;
+                }
+            }
+        }
+
+        std::vector<const ControlBlock*> pending;
+        for (auto& [cb, node] : nodes) {
+            if (Base::load(cb->shared_count) > node.internal) {
+                node.reachable = true;
+                pending.push_back(cb);
+            }
+        }
+        while (!pending.empty()) {
+            const ControlBlock* cb = pending.back();
+            pending.pop_back();
+            for (const ControlBlock* child : nodes[cb].children) {
+                auto found = nodes.find(child);
+                if (found != nodes.end() && !found->second.reachable) {
+                    found->second.reachable = true;
+                    pending.push_back(child);
+                }
+            }
+        }
+
+        std::vector<LiveBlock> garbage;
+        for (const auto& [cb, node] : nodes) {
+            if (!node.reachable) {
+                garbage.push_back(describe(cb, all.blocks.at(cb)));
+            }
+        }
+        return garbage;
+    }
+
+  private:
+    using ChildrenFn = void (*)(const void*,
+                                std::vector<const ControlBlock*>&);
+
+    struct Entry {
+        const std::type_info* type;
+        const void* object;
+        size_t bytes;
+        ChildrenFn children;
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::unordered_map<const ControlBlock*, Entry> blocks;
+    };
+
+    struct ChildCollector {
+        std::vector<const ControlBlock*>& children;
+
+        template <typename U>
+        void operator()(const SharedPtr<U, TrackedPolicy>& child) const {
+            if (child.cb != nullptr) {
+                children.push_back(child.cb);
+            }
+        }
+    };
+
+    template <typename T>
+    using visit_children_t = decltype(std::declval<const T&>().visitChildren(
+        std::declval<ChildCollector>()));
+
+    template <typename T, typename = void>
+    struct has_children : std::false_type {};
+
+    template <typename T>
+    struct has_children<T, std::void_t<visit_children_t<T>>>
+        : std::true_type {};
+
+    template <typename T>
+    static void collectChildren(const void* object,
+                                std::vector<const ControlBlock*>& children) {
+        static_cast<const T*>(object)->visitChildren(ChildCollector{children});
+    }
+
+    // Leaves out the weak reference held jointly by the shared owners.
+    static LiveBlock describe(const ControlBlock* cb, const Entry& entry) {
+        size_t use_count = Base::load(cb->shared_count);
+        size_t weak_count = Base::load(cb->weak_count);
+        if (use_count != 0 && weak_count != 0) {
+            --weak_count;
+        }
+        return LiveBlock{cb,         entry.object, entry.type,
+                         entry.bytes, use_count,   weak_count};
+    }
+
+    static std::string typeName(const std::type_info* type) {
+        if (type == nullptr) {
+            return "<incomplete>";
+        }
+#ifdef SMART_POINTERS_HAS_DEMANGLE
+        int status = 0;
+        char* demangled =
+            abi::__cxa_demangle(type->name(), nullptr, nullptr, &status);
+        if (status == 0) {
+            std::string name = demangled;
+            std::free(demangled);
+            return name;
+        }
+#endif
+        return type->name();
+    }
+
+    // Never destroyed: blocks may be freed during static destruction.
+    static Registry& registry() {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+};
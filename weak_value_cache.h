@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "smart_pointers.h"
+
+// Maps keys to objects owned elsewhere: an entry keeps its value only as
+// long as some SharedPtr to it is alive. Keys are spread over kShards
+// independently locked shards. Expired entries are not erased when a
+// lookup finds them but swept a whole shard at a time, once the inserts
+// since the last sweep reach half the shard's size, which keeps purging
+// amortised O(1) per insert.
+template <typename K, typename T, typename Policy = AtomicPolicy,
+          typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class WeakValueCache {
+  public:
+    static constexpr size_t kShards = 16;
+    static constexpr size_t kMinSweepInterval = 64;
+
+    WeakValueCache() = default;
+
+    WeakValueCache(const WeakValueCache&) = delete;
+    WeakValueCache& operator=(const WeakValueCache&) = delete;
+
+    // Empty when the key is absent or its value has expired.
+    SharedPtr<T, Policy> find(const K& key) const {
+        const Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.entries.find(key);
+        if (found == shard.entries.end()) {
+            return SharedPtr<T, Policy>();
+        }
+        return found->second.lock();
+    }
+
+    void insert(const K& key, const SharedPtr<T, Policy>& value) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        store(shard, key, value);
+    }
+
+    // Returns the live value for `key`, or stores and returns make().
+    // make() runs under the shard lock, so each key is created once even
+    // when threads race for it; it must not use the cache itself.
+    template <typename Make>
+    SharedPtr<T, Policy> findOrInsert(const K& key, Make&& make) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.entries.find(key);
+        if (found != shard.entries.end()) {
+            if (SharedPtr<T, Policy> live = found->second.lock();
+                live.get() != nullptr) {
+                return live;
+            }
+        }
+        SharedPtr<T, Policy> value = std::forward<Make>(make)();
+        store(shard, key, value);
+        return value;
+    }
+
+    void erase(const K& key) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.erase(key);
+    }
+
+    // Sweeps every shard now rather than when it is next due.
+    void purge() {
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            sweep(shard);
+        }
+    }
+
+    // Entries including expired ones not yet swept.
+    size_t size() const {
+        size_t total = 0;
+        for (const Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.entries.size();
+        }
+        return total;
+    }
+
+  private:
+    struct alignas(kCacheLineSize) Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<K, WeakPtr<T, Policy>, Hash, KeyEqual> entries;
+        size_t inserts_since_sweep = 0;
+    };
+
+    // The high bits of a multiplicative mix, so that the shard does not
+    // correlate with the buckets the same hash picks inside the shard.
+    size_t shardIndex(const K& key) const {
+        uint64_t mixed =
+            static_cast<uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(mixed >> 32) % kShards;
+    }
+
+    Shard& shardFor(const K& key) {
+        return shards[shardIndex(key)];
+    }
+
+    const Shard& shardFor(const K& key) const {
+        return shards[shardIndex(key)];
+    }
+
+    void store(Shard& shard, const K& key,
+               const SharedPtr<T, Policy>& value) {
+        shard.entries.insert_or_assign(key, WeakPtr<T, Policy>(value));
+        if (++shard.inserts_since_sweep >= kMinSweepInterval &&
+            shard.inserts_since_sweep >= shard.entries.size() / 2) {
+            sweep(shard);
+        }
+    }
+
+    static void sweep(Shard& shard) {
+        for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+            if (it->second.expired()) {
+                it = shard.entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        shard.inserts_since_sweep = 0;
+    }
+
+    Shard shards[kShards];
+};